@@ -0,0 +1,52 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_capture.h
+ *	  format of the block access captures written by the ocalls.
+ *
+ * A capture file starts with an OblivCaptureHeader followed by one
+ * OblivCaptureRecord per block requested by the enclave, in the order of
+ * the requests. The blocks of a vectored ocall are stored as consecutive
+ * records, all but the first with OBLIV_CAPTURE_CONT set. The fields are in
+ * the byte order of the host that wrote the capture.
+ *
+ * The header only uses the C library types, so that the tools can read the
+ * captures without the PostgreSQL headers.
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_capture.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_CAPTURE_H
+#define OBLIV_CAPTURE_H
+
+#include <stdint.h>
+
+#define OBLIV_CAPTURE_MAGIC 0x4F424C43	/* "OBLC" */
+#define OBLIV_CAPTURE_VERSION 1
+
+/* Values of OblivCaptureRecord.op */
+#define OBLIV_CAPTURE_READ 0
+#define OBLIV_CAPTURE_WRITE 1
+
+/* Flags of OblivCaptureRecord.flags */
+#define OBLIV_CAPTURE_CONT 0x0001	/* same ocall as the previous record */
+
+typedef struct OblivCaptureHeader
+{
+	uint32_t	magic;			/* OBLIV_CAPTURE_MAGIC */
+	uint16_t	version;		/* OBLIV_CAPTURE_VERSION */
+	uint16_t	recordSize;		/* sizeof(OblivCaptureRecord) */
+} OblivCaptureHeader;
+
+typedef struct OblivCaptureRecord
+{
+	uint32_t	blkno;			/* block of the ORAM file */
+	uint32_t	size;			/* bytes requested */
+	uint8_t		fileId;			/* OBLIV_HEAP_FILE or OBLIV_INDEX_FILE */
+	uint8_t		op;				/* OBLIV_CAPTURE_READ or OBLIV_CAPTURE_WRITE */
+	uint16_t	flags;
+} OblivCaptureRecord;
+
+#endif							/* OBLIV_CAPTURE_H */
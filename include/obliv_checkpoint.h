@@ -0,0 +1,40 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_checkpoint.h
+ *	  prototypes for contrib/oblivpg_fdw/obliv_checkpoint.c.
+ *
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_checkpoint.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_CHECKPOINT_H
+#define OBLIV_CHECKPOINT_H
+
+#include "postgres.h"
+
+#define OBLIV_STATE_MAGIC 0x4F425354	/* "OBST" */
+#define OBLIV_STATE_VERSION 1
+
+/*
+ * Header of a checkpoint file. It is followed by the ORAM state sealed by
+ * the enclave (position map, stash and tree metadata), which is opaque to
+ * the untrusted side.
+ */
+typedef struct OblivStateHeader
+{
+	uint32		magic;
+	uint32		version;
+	Oid			ftwOid;			/* foreign table of the ORAM */
+	int32		typeOp;			/* init_soe initialization type */
+	int32		opmode;			/* init_soe operation mode */
+	uint32		sealedSize;		/* bytes of sealed state after the header */
+} OblivStateHeader;
+
+void		writeOblivState(Oid ftwOid, Oid mirrorOid, OblivStateHeader *header, const char *sealed);
+char	   *readOblivState(Oid ftwOid, Oid mirrorOid, OblivStateHeader *header);
+void		discardOblivState(void);
+
+#endif							/* OBLIV_CHECKPOINT_H */
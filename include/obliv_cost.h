@@ -0,0 +1,52 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_cost.h
+ *	  prototypes for contrib/oblivpg_fdw/obliv_cost.c.
+ *
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_cost.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_COST_H
+#define OBLIV_COST_H
+
+#include "postgres.h"
+#include "include/obliv_status.h"
+#include "nodes/relation.h"
+
+/* Current ORAM bucket capacity is hardcoded to 1 block by the SOE. */
+#define OBLIV_BUCKET_CAPACITY 1
+
+/* Shapes of the oblivious scan answering the restriction clauses */
+#define OBLIV_SCAN_FULL 0		/* no clause on the indexed column */
+#define OBLIV_SCAN_LOOKUP 1		/* equality on the indexed column */
+#define OBLIV_SCAN_RANGE 2		/* bounds on the indexed column */
+#define OBLIV_SCAN_MULTI 3		/* IN list or = ANY (array) */
+
+/*
+ * Planner information of a foreign table, stored in baserel->fdw_private by
+ * GetForeignRelSize.
+ */
+typedef struct OblivRelInfo
+{
+	OblivTableCacheEntry table;
+	int			scanShape;		/* OBLIV_SCAN_* */
+	double		nkeys;			/* lookups of a multi-key scan */
+	double		heapPathBlocks; /* blocks of a path of the heap ORAM */
+	double		indexPathBlocks;	/* blocks of a path of the index ORAM */
+	int			indexLevels;	/* index ORAM accesses of a lookup */
+} OblivRelInfo;
+
+/* GUC variables */
+extern double oblivEcallCost;
+extern double oblivOcallCost;
+extern double oblivBlockCost;
+
+void		oblivSetGeometry(OblivRelInfo *relInfo);
+void		oblivEstimateCosts(RelOptInfo *baserel, OblivRelInfo *relInfo, int scanShape,
+							   double nkeys, double rows, Cost *startupCost, Cost *totalCost);
+
+#endif							/* OBLIV_COST_H */
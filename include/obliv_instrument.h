@@ -0,0 +1,61 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_instrument.h
+ *	  counters of the enclave transitions and of the ORAM block I/O.
+ *
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_instrument.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_INSTRUMENT_H
+#define OBLIV_INSTRUMENT_H
+
+#include "postgres.h"
+#include "portability/instr_time.h"
+
+/* Wait events reported by the backends */
+#define OBLIV_WAIT_ECALL 0		/* ObliviousEcall */
+#define OBLIV_WAIT_PATH_READ 1	/* ObliviousPathRead */
+#define OBLIV_WAIT_EVICTION 2	/* ObliviousEviction */
+
+#define OBLIV_WAIT_NEVENTS 3
+
+/* Same ids as OBLIV_HEAP_FILE and OBLIV_INDEX_FILE */
+#define OBLIV_USAGE_FILES 2
+
+/*
+ * Work done by the enclave on behalf of the backend. Like pgBufferUsage,
+ * the counters of oblivUsage only grow, and a scan computes its own usage
+ * from the difference of the counters before and after its ecalls.
+ */
+typedef struct OblivUsage
+{
+	int64		ecalls;			/* ecalls of the scans and inserts */
+	int64		ocallReads;		/* outFileRead and outFileReadv calls */
+	int64		ocallWrites;	/* outFileWrite and outFileWritev calls */
+	int64		blocksRead[OBLIV_USAGE_FILES];	/* per ORAM file */
+	int64		blocksWritten[OBLIV_USAGE_FILES];
+	int64		bytesCrossed;	/* bytes copied across the enclave boundary */
+	instr_time	enclaveTime;	/* time inside the ecalls, ocalls included */
+	instr_time	ioTime;			/* time inside the block ocalls */
+	int			stashHighWater; /* largest stash of a scan, not accumulated */
+} OblivUsage;
+
+extern OblivUsage oblivUsage;
+
+/* Time the ecalls and ocalls, set during the ecalls of EXPLAIN ANALYZE */
+extern bool oblivTrackTiming;
+
+void		oblivEcallStart(instr_time *start, Oid ftwOid);
+void		oblivEcallEnd(instr_time *start, int op, int64 bytes);
+void		oblivOcallStart(instr_time *start, bool isWrite);
+void		oblivOcallEnd(instr_time *start, int fileId, Oid relId, bool isWrite, int blkno,
+						  int nblocks, int64 bytes);
+uint32		oblivWaitStart(int event);
+void		oblivWaitEnd(uint32 saved);
+void		oblivUsageAccumDiff(OblivUsage *dst, const OblivUsage *add, const OblivUsage *sub);
+
+#endif							/* OBLIV_INSTRUMENT_H */
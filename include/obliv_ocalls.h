@@ -7,11 +7,105 @@
 
 #include "obliv_status.h"
 
+/*
+ * Ids of the ORAM files addressed by the enclave on the block ocalls. The
+ * ids are part of the ocall interface shared with the SOE library.
+ */
+#define OBLIV_HEAP_FILE 0
+#define OBLIV_INDEX_FILE 1
+
+#define OBLIV_NFILES 2
+
+/*
+ * Maximum number of blocks of a chunk of the initial ORAM image sent by
+ * outFileInit (8MB with the default block size).
+ */
+#define OBLIV_INIT_MAX_CHUNK_BLOCKS 1024
+
 void		print_status(void);
 void		setupOblivStatus(FdwOblivTableStatus instatus, const char *tableName, const char *indexName, Oid indexHandlerOID);
 void		initIndex(const char *filename, const char *pages, unsigned int nblocks, unsigned int blockSize, int initOffset);
-void		initRelation(const char *filename, const char *pages, unsigned int nblocks, unsigned int blockSize);
+void		initRelation(const char *filename, const char *pages, unsigned int nblocks, unsigned int blockSize, int initOffset);
 
 void		closeOblivStatus(void);
+void		syncOblivFiles(void);
+double		calibrateOblivStorage(int fileId, BlockNumber nblocks, int loops);
+
+/*
+ * Ocalls of the SOE library. The library links them directly when built
+ * with UNSAFE, and then expects an sgx_status_t.
+ */
+#ifdef UNSAFE
+#include "Enclave_dt.h"
+#endif
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileInit(const char *filename, const char *pages, unsigned int nblocks, unsigned int blocksize, int pageSize, int initOffset);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileAllocate(const char *filename, unsigned int nblocks);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileRead(char *page, int fileId, int blkno, int pageSize);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileWrite(const char *page, int fileId, int blkno, int pageSize);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileReadv(char *pages, int fileId, const int *blknos, int nblocks, int pageSize);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFilePrefetch(int fileId, const int *blknos, int nblocks);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileWritev(const char *pages, int fileId, const int *blknos, int nblocks, int pageSize);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outCalibrate(void);
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileClose(const char *filename);
+
+/* Capture of the block accesses, in obliv_capture.c */
+extern char *oblivCaptureFile;
+
+void		oblivCaptureBlocks(int fileId, bool isWrite, const int *blknos, int nblocks, int pageSize);
+void		oblivCaptureFlush(void);
 
 #endif							/* //FDW_OBLIV_OFILE_H */
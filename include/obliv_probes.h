@@ -0,0 +1,106 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_probes.h
+ *	  static trace probes at the ecall and ocall boundaries.
+ *
+ * When built with DTRACE=1, the probes are USDT probes of the oblivpg
+ * provider (sys/sdt.h), like the TRACE_POSTGRESQL_* probes of the server,
+ * and can be attached with bpftrace, perf or SystemTap on a production
+ * build. Otherwise they compile to nothing.
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_probes.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_PROBES_H
+#define OBLIV_PROBES_H
+
+#ifdef OBLIV_DTRACE
+
+#include <sys/sdt.h>
+
+/* ecalls: foreign table oid and the arguments of the call */
+#define TRACE_OBLIVPG_GETTUPLE_START(ftwOid, capacity) \
+	DTRACE_PROBE2(oblivpg, gettuple__start, ftwOid, capacity)
+#define TRACE_OBLIVPG_GETTUPLE_DONE(ftwOid, ntuples) \
+	DTRACE_PROBE2(oblivpg, gettuple__done, ftwOid, ntuples)
+#define TRACE_OBLIVPG_INSERT_START(ftwOid, tupleSize) \
+	DTRACE_PROBE2(oblivpg, insert__start, ftwOid, tupleSize)
+#define TRACE_OBLIVPG_INSERT_DONE(ftwOid) \
+	DTRACE_PROBE1(oblivpg, insert__done, ftwOid)
+#define TRACE_OBLIVPG_INSERT_HEAP_START(ftwOid, tupleSize) \
+	DTRACE_PROBE2(oblivpg, insert__heap__start, ftwOid, tupleSize)
+#define TRACE_OBLIVPG_INSERT_HEAP_DONE(ftwOid) \
+	DTRACE_PROBE1(oblivpg, insert__heap__done, ftwOid)
+#define TRACE_OBLIVPG_ADD_HEAP_BLOCK_START(blkno) \
+	DTRACE_PROBE1(oblivpg, add__heap__block__start, blkno)
+#define TRACE_OBLIVPG_ADD_HEAP_BLOCK_DONE(blkno) \
+	DTRACE_PROBE1(oblivpg, add__heap__block__done, blkno)
+#define TRACE_OBLIVPG_ADD_INDEX_BLOCK_START(offset, level) \
+	DTRACE_PROBE2(oblivpg, add__index__block__start, offset, level)
+#define TRACE_OBLIVPG_ADD_INDEX_BLOCK_DONE(offset, level) \
+	DTRACE_PROBE2(oblivpg, add__index__block__done, offset, level)
+#define TRACE_OBLIVPG_INIT_SOE_START(ftwOid, tableBlocks, indexBlocks) \
+	DTRACE_PROBE3(oblivpg, init__soe__start, ftwOid, tableBlocks, indexBlocks)
+#define TRACE_OBLIVPG_INIT_SOE_DONE(ftwOid, status) \
+	DTRACE_PROBE2(oblivpg, init__soe__done, ftwOid, status)
+#define TRACE_OBLIVPG_INIT_FSOE_START(ftwOid, tableBlocks) \
+	DTRACE_PROBE2(oblivpg, init__fsoe__start, ftwOid, tableBlocks)
+#define TRACE_OBLIVPG_INIT_FSOE_DONE(ftwOid, status) \
+	DTRACE_PROBE2(oblivpg, init__fsoe__done, ftwOid, status)
+
+/* ocalls: ORAM file id, block number or number of blocks, and block size */
+#define TRACE_OBLIVPG_FILE_READ_START(fileId, blkno, size) \
+	DTRACE_PROBE3(oblivpg, file__read__start, fileId, blkno, size)
+#define TRACE_OBLIVPG_FILE_READ_DONE(fileId, blkno, size) \
+	DTRACE_PROBE3(oblivpg, file__read__done, fileId, blkno, size)
+#define TRACE_OBLIVPG_FILE_WRITE_START(fileId, blkno, size) \
+	DTRACE_PROBE3(oblivpg, file__write__start, fileId, blkno, size)
+#define TRACE_OBLIVPG_FILE_WRITE_DONE(fileId, blkno, size) \
+	DTRACE_PROBE3(oblivpg, file__write__done, fileId, blkno, size)
+#define TRACE_OBLIVPG_FILE_READV_START(fileId, nblocks, size) \
+	DTRACE_PROBE3(oblivpg, file__readv__start, fileId, nblocks, size)
+#define TRACE_OBLIVPG_FILE_READV_DONE(fileId, nblocks, size) \
+	DTRACE_PROBE3(oblivpg, file__readv__done, fileId, nblocks, size)
+#define TRACE_OBLIVPG_FILE_WRITEV_START(fileId, nblocks, size) \
+	DTRACE_PROBE3(oblivpg, file__writev__start, fileId, nblocks, size)
+#define TRACE_OBLIVPG_FILE_WRITEV_DONE(fileId, nblocks, size) \
+	DTRACE_PROBE3(oblivpg, file__writev__done, fileId, nblocks, size)
+#define TRACE_OBLIVPG_FILE_INIT_START(fileId, firstBlock, nblocks, size) \
+	DTRACE_PROBE4(oblivpg, file__init__start, fileId, firstBlock, nblocks, size)
+#define TRACE_OBLIVPG_FILE_INIT_DONE(fileId, firstBlock, nblocks, size) \
+	DTRACE_PROBE4(oblivpg, file__init__done, fileId, firstBlock, nblocks, size)
+
+#else							/* !OBLIV_DTRACE */
+
+#define TRACE_OBLIVPG_GETTUPLE_START(ftwOid, capacity) do {} while (0)
+#define TRACE_OBLIVPG_GETTUPLE_DONE(ftwOid, ntuples) do {} while (0)
+#define TRACE_OBLIVPG_INSERT_START(ftwOid, tupleSize) do {} while (0)
+#define TRACE_OBLIVPG_INSERT_DONE(ftwOid) do {} while (0)
+#define TRACE_OBLIVPG_INSERT_HEAP_START(ftwOid, tupleSize) do {} while (0)
+#define TRACE_OBLIVPG_INSERT_HEAP_DONE(ftwOid) do {} while (0)
+#define TRACE_OBLIVPG_ADD_HEAP_BLOCK_START(blkno) do {} while (0)
+#define TRACE_OBLIVPG_ADD_HEAP_BLOCK_DONE(blkno) do {} while (0)
+#define TRACE_OBLIVPG_ADD_INDEX_BLOCK_START(offset, level) do {} while (0)
+#define TRACE_OBLIVPG_ADD_INDEX_BLOCK_DONE(offset, level) do {} while (0)
+#define TRACE_OBLIVPG_INIT_SOE_START(ftwOid, tableBlocks, indexBlocks) do {} while (0)
+#define TRACE_OBLIVPG_INIT_SOE_DONE(ftwOid, status) do {} while (0)
+#define TRACE_OBLIVPG_INIT_FSOE_START(ftwOid, tableBlocks) do {} while (0)
+#define TRACE_OBLIVPG_INIT_FSOE_DONE(ftwOid, status) do {} while (0)
+
+#define TRACE_OBLIVPG_FILE_READ_START(fileId, blkno, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_READ_DONE(fileId, blkno, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_WRITE_START(fileId, blkno, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_WRITE_DONE(fileId, blkno, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_READV_START(fileId, nblocks, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_READV_DONE(fileId, nblocks, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_WRITEV_START(fileId, nblocks, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_WRITEV_DONE(fileId, nblocks, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_INIT_START(fileId, firstBlock, nblocks, size) do {} while (0)
+#define TRACE_OBLIVPG_FILE_INIT_DONE(fileId, firstBlock, nblocks, size) do {} while (0)
+
+#endif							/* OBLIV_DTRACE */
+
+#endif							/* OBLIV_PROBES_H */
@@ -0,0 +1,77 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_remote_proto.h
+ *	  wire protocol between the remote storage backend and the block server.
+ *
+ * A client opens a connection to tools/obliv_blockserver over TCP or a
+ * Unix socket and sends a HELLO request with the protocol version, then
+ * OPEN requests that return a handle for each ORAM file. Every request is
+ * an OblivRemoteRequest header followed by its payload, and every request
+ * is answered by an OblivRemoteResponse header followed by its payload, in
+ * the order of the requests. A client can therefore send several requests
+ * before reading their responses, matching them by id.
+ *
+ * The blocks of an ORAM path travel in a single frame: a READ or WRITE
+ * request carries up to OBLIV_REMOTE_MAX_BLOCKS block numbers, followed by
+ * the pages for a WRITE, and the response of a READ carries the pages in
+ * the order of the block numbers. The blocks past the end of a file read
+ * as zeros.
+ *
+ * All the integers are in network byte order. The header only uses the C
+ * library types, so that the tools can be built without the PostgreSQL
+ * headers.
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_remote_proto.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_REMOTE_PROTO_H
+#define OBLIV_REMOTE_PROTO_H
+
+#include <stdint.h>
+
+#define OBLIV_REMOTE_VERSION 1
+
+/* Limits of a frame */
+#define OBLIV_REMOTE_MAX_BLOCKS 1024
+#define OBLIV_REMOTE_MAX_BLOCK_SIZE 32768
+#define OBLIV_REMOTE_MAX_NAME 255
+#define OBLIV_REMOTE_MAX_HANDLES 16
+
+/* Request types, echoed in the responses */
+#define OBLIV_REMOTE_HELLO 1		/* nblocks is the protocol version */
+#define OBLIV_REMOTE_OPEN 2			/* payload is the file name */
+#define OBLIV_REMOTE_READ 3			/* payload is nblocks block numbers */
+#define OBLIV_REMOTE_WRITE 4		/* block numbers followed by the pages */
+#define OBLIV_REMOTE_PREFETCH 5		/* block numbers, no pages returned */
+#define OBLIV_REMOTE_ALLOCATE 6		/* resets the file to nblocks zero blocks */
+#define OBLIV_REMOTE_SYNC 7			/* makes the writes of the file durable */
+
+/* Response status */
+#define OBLIV_REMOTE_OK 0
+#define OBLIV_REMOTE_ERROR 1		/* payload is the error message */
+
+typedef struct OblivRemoteRequest
+{
+	uint32_t	length;			/* bytes of the payload */
+	uint32_t	id;				/* chosen by the client */
+	uint8_t		type;			/* OBLIV_REMOTE_* */
+	uint8_t		handle;			/* file returned by OPEN */
+	uint16_t	reserved;
+	uint32_t	nblocks;
+	uint32_t	blockSize;
+} OblivRemoteRequest;
+
+typedef struct OblivRemoteResponse
+{
+	uint32_t	length;			/* bytes of the payload */
+	uint32_t	id;				/* id of the request */
+	uint8_t		type;			/* type of the request */
+	uint8_t		status;			/* OBLIV_REMOTE_OK or OBLIV_REMOTE_ERROR */
+	uint16_t	handle;			/* file opened by an OPEN request */
+	uint32_t	nblocks;		/* blocks returned by a READ */
+} OblivRemoteResponse;
+
+#endif							/* OBLIV_REMOTE_PROTO_H */
@@ -0,0 +1,43 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_stats.h
+ *	  prototypes for contrib/oblivpg_fdw/obliv_stats.c.
+ *
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_stats.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_STATS_H
+#define OBLIV_STATS_H
+
+#include "postgres.h"
+
+/* Maximum number of foreign tables with statistics */
+#define OBLIV_STATS_MAX_TABLES 64
+
+/* Operations with a latency histogram */
+#define OBLIV_STAT_ECALL_SCAN 0 /* getTupleBatch, getTupleRange, getTupleMulti */
+#define OBLIV_STAT_ECALL_INSERT 1	/* insert and insertHeap */
+#define OBLIV_STAT_OCALL_READ 2 /* outFileRead and outFileReadv */
+#define OBLIV_STAT_OCALL_WRITE 3	/* outFileWrite and outFileWritev */
+
+#define OBLIV_STAT_NOPS 4
+
+/*
+ * Bucket i of a histogram counts the latencies in [2^i, 2^(i+1))
+ * microseconds, bucket 0 the latencies below 2 microseconds.
+ */
+#define OBLIV_STAT_BUCKETS 32
+
+void		oblivStatsRequest(void);
+bool		oblivStatsEnabled(void);
+void		oblivStatsBeginEcall(Oid ftwOid);
+void		oblivStatsEndEcall(int op, double usec, int64 bytes);
+void		oblivStatsOcall(int op, int nblocks, int64 bytes, double usec);
+void		oblivStatsLookup(int nkeys);
+void		oblivStatsInsert(void);
+
+#endif							/* OBLIV_STATS_H */
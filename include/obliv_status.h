@@ -77,6 +77,26 @@ typedef struct FdwOblivTableStatus
 } FdwOblivTableStatus;
 
 
+/*
+ * Backend-local cache entry of an oblivious table. It holds the row of the
+ * mapping table and the mirror index information needed by every scan and
+ * insert, so that they do not scan the mapping table or open the index.
+ */
+typedef struct OblivTableCacheEntry
+{
+	Oid			ftwOid;			/* hash key, must be first */
+	FdwOblivTableStatus status;
+	AttrNumber	indexedColumn;	/* column of the mirror index */
+	Oid			indexAm;		/* access method of the mirror index */
+	Oid			indexOpfamily;
+	Oid			indexOpcintype;
+	Oid			indexCollation;
+	Oid			indexCmpProc;	/* BTORDER_PROC of a btree mirror index */
+	bool		indexUnique;	/* mirror index is unique */
+	int			indexTreeHeight;	/* levels above the leaves of a btree */
+} OblivTableCacheEntry;
+
+
 typedef struct OblivWriteState
 {
 
@@ -91,6 +111,10 @@ Ostatus		validateIndexStatus(FdwOblivTableStatus toValidate);
 
 void		setOblivStatusInitated(FdwOblivTableStatus status, Relation mappingRel);
 
+Oid			getOblivMappingOid(void);
+
+bool		lookupOblivTable(Oid ftwOid, OblivTableCacheEntry *entry);
+
 char*       getNextSearchTerm(Oid);
 
 #endif							/* OBLIV_STATUS_H */
@@ -0,0 +1,127 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_storage.h
+ *	  storage backends used by the ocalls to access the ORAM files.
+ *
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_storage.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_STORAGE_H
+#define OBLIV_STORAGE_H
+
+#include "postgres.h"
+#include "storage/block.h"
+#include "utils/guc.h"
+#include "utils/relcache.h"
+
+/* Values of the oblivpg_fdw.storage setting */
+#define OBLIV_STORAGE_BUFMGR 0
+#define OBLIV_STORAGE_URING 1
+#define OBLIV_STORAGE_MMAP 2
+#define OBLIV_STORAGE_REMOTE 3
+
+/* Values of the oblivpg_fdw.inject_distribution setting */
+#define OBLIV_INJECT_FIXED 0
+#define OBLIV_INJECT_UNIFORM 1
+#define OBLIV_INJECT_EXPONENTIAL 2
+
+struct OblivStorageRoutine;
+
+/*
+ * An ORAM file that the enclave can address by its file id.
+ *
+ * The relation is opened once when the SOE is initialized and stays open
+ * until close_enclave, so that block accesses do not go through the
+ * relcache or the lock manager.
+ */
+typedef struct OblivFile
+{
+	char	   *name;			/* relation name known by the enclave */
+	Oid			relId;			/* mirror relation storing the ORAM file */
+	bool		isIndex;
+	Relation	rel;			/* NULL when the file is not registered */
+
+	const struct OblivStorageRoutine *storage;	/* I/O backend of the file */
+	bool		attached;		/* storage has taken over the file */
+	void	   *storagePrivate; /* state of the storage backend */
+
+	bool		initInProgress; /* initialization chunks are being received */
+	BlockNumber initNext;		/* first block of the next chunk */
+
+	uint8	   *lazyWritten;	/* blocks written since a lazy allocation */
+	BlockNumber lazyBlocks;		/* number of blocks of the bitmap */
+
+	int			treetopSlot;	/* treetop cache entry, -1 if not cached */
+} OblivFile;
+
+/*
+ * Block I/O callbacks of a storage backend.
+ *
+ * attach is invoked before the first block access after the file has been
+ * initialized, and detach when the file is unregistered or initialized
+ * again. Both are optional. sync makes the writes of the file durable.
+ * Block i of a vectored request is stored at offset i * pageSize of the
+ * pages buffer.
+ *
+ * init and allocate are set by the backends that do not store the files in
+ * the mirror relations. They receive the chunks of the initial image and
+ * the lazy allocations instead of the storage manager, and sync is called
+ * at the end of the initialization.
+ */
+typedef struct OblivStorageRoutine
+{
+	const char *name;
+	void		(*attach) (OblivFile *file);
+	void		(*detach) (OblivFile *file);
+	void		(*readv) (OblivFile *file, const int *blknos, int nblocks,
+						  char *pages, int pageSize);
+	void		(*writev) (OblivFile *file, const int *blknos, int nblocks,
+						   const char *pages, int pageSize);
+	void		(*prefetch) (OblivFile *file, const int *blknos, int nblocks);
+	void		(*sync) (OblivFile *file);
+	void		(*init) (OblivFile *file, const char *pages, BlockNumber firstBlock,
+						 int nblocks, int pageSize);
+	void		(*allocate) (OblivFile *file, BlockNumber nblocks);
+} OblivStorageRoutine;
+
+/*
+ * Segment files of an ORAM relation, for the backends that access the
+ * files directly instead of going through shared buffers.
+ */
+typedef struct OblivSegments
+{
+	BlockNumber nblocks;		/* size of the relation when it was opened */
+	int			nsegs;
+	int		   *fds;			/* descriptor of each segment file */
+} OblivSegments;
+
+/* GUC variables */
+extern int	oblivStorageKind;
+extern bool oblivDirectIO;
+extern const struct config_enum_entry oblivStorageOptions[];
+extern int	oblivInjectLatency;
+extern int	oblivInjectDistribution;
+extern int	oblivInjectQueueDepth;
+extern int	oblivInjectBandwidth;
+extern const struct config_enum_entry oblivInjectOptions[];
+extern char *oblivRemoteAddress;
+extern int	oblivRemotePipelineDepth;
+extern int	oblivRemoteTimeout;
+
+extern const OblivStorageRoutine oblivBufmgrStorage;
+extern const OblivStorageRoutine oblivMmapStorage;
+extern const OblivStorageRoutine oblivRemoteStorage;
+
+void		oblivDropBuffers(OblivFile *file);
+void		oblivOpenSegments(OblivFile *file, int flags, OblivSegments *segs);
+void		oblivCloseSegments(OblivFile *file, OblivSegments *segs);
+
+#ifdef OBLIV_URING
+extern const OblivStorageRoutine oblivUringStorage;
+#endif
+
+#endif							/* OBLIV_STORAGE_H */
@@ -0,0 +1,35 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_trace.h
+ *	  prototypes for contrib/oblivpg_fdw/obliv_trace.c.
+ *
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_trace.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_TRACE_H
+#define OBLIV_TRACE_H
+
+#include "postgres.h"
+#include "portability/instr_time.h"
+
+/* Types of the trace events */
+#define OBLIV_TRACE_SCAN 0		/* a foreign scan starts */
+#define OBLIV_TRACE_ECALL_SCAN 1	/* getTupleBatch, getTupleRange, getTupleMulti */
+#define OBLIV_TRACE_ECALL_INSERT 2	/* insert and insertHeap */
+#define OBLIV_TRACE_READ 3		/* outFileRead and outFileReadv */
+#define OBLIV_TRACE_WRITE 4		/* outFileWrite and outFileWritev */
+#define OBLIV_TRACE_TUPLE 5		/* a tuple is returned by a scan */
+
+/* GUC variables */
+extern int	oblivTraceBufferSize;
+
+bool		oblivTraceEnabled(void);
+void		oblivTraceInstant(int type, Oid relId);
+void		oblivTraceSpan(int type, Oid relId, int fileId, int blkno, int count,
+						   instr_time *start, instr_time *duration);
+
+#endif							/* OBLIV_TRACE_H */
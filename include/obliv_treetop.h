@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_treetop.h
+ *	  prototypes for contrib/oblivpg_fdw/obliv_treetop.c.
+ *
+ *
+ * Copyright (c) 2018-2019, HASLab
+ *
+ * contrib/oblivpg_fdw/include/obliv_treetop.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef OBLIV_TREETOP_H
+#define OBLIV_TREETOP_H
+
+#include "postgres.h"
+#include "include/obliv_storage.h"
+
+/* Maximum number of ORAM files cached at the same time */
+#define OBLIV_TREETOP_FILES 4
+
+/* GUC variables */
+extern int	oblivTreetopLevels;
+
+void		oblivTreetopRequest(void);
+void		oblivTreetopAcquire(OblivFile *file);
+void		oblivTreetopRelease(OblivFile *file);
+void		oblivTreetopFlush(OblivFile *file);
+void		oblivTreetopInvalidate(OblivFile *file);
+bool		oblivTreetopRead(OblivFile *file, BlockNumber blkno, char *page, int pageSize);
+void		oblivTreetopFill(OblivFile *file, BlockNumber blkno, const char *page, int pageSize);
+bool		oblivTreetopWrite(OblivFile *file, BlockNumber blkno, const char *page, int pageSize);
+
+#endif							/* OBLIV_TREETOP_H */
@@ -6,12 +6,24 @@
 #define OBLIVPG_FDW_H
 
 #include "access/tupdesc.h"
+#include "fmgr.h"
+#include "nodes/pg_list.h"
 #include "utils/rel.h"
 #include "access/htup_details.h"
 #include "storage/lwlock.h"
+#include "include/obliv_instrument.h"
 
 #define MAX_TERM_SIZE 200
 
+/* Number of tuples returned by the enclave in a single getTuple call */
+#define OBLIV_TUPLE_BATCH_SIZE 32
+
+/* Bounds of a range scan passed to the enclave */
+#define OBLIV_RANGE_LOW				0x01	/* lowKey is set */
+#define OBLIV_RANGE_LOW_INCLUSIVE	0x02	/* >= instead of > */
+#define OBLIV_RANGE_HIGH			0x04	/* highKey is set */
+#define OBLIV_RANGE_HIGH_INCLUSIVE	0x08	/* <= instead of < */
+
 /*
  * Execution state of a foreign scan using postgres_fdw.
  *
@@ -21,6 +33,7 @@ typedef struct OblivScanState
 {
 
 
+	Oid			ftwOid;			/* foreign table of the scan */
 	Relation	mirrorTable;	/* relchache entry for the mirror table */
 	TupleDesc	tableTupdesc;	/* table tuple descriptor for scan */
 
@@ -28,11 +41,15 @@ typedef struct OblivScanState
 	/*
 	 * for storing result tuples
 	 *
-	 * In the future oblivpg might have a batch of resuts to return to the
-	 * client
+	 * The enclave returns up to OBLIV_TUPLE_BATCH_SIZE tuples per getTuple
+	 * call, which are served by the iterate callback before calling the
+	 * enclave again.
 	 */
-	HeapTupleData tuple;		/* array of currently-retrieved tuples */
-	HeapTupleHeader tupleHeader;	/* Temporary Tuple Header location */
+	HeapTupleData *tuples;		/* array of currently-retrieved tuples */
+	char	   *tupleHeaders;	/* headers of the tuples, MAX_TUPLE_SIZE each */
+	int			numTuples;		/* # of tuples in array */
+	int			nextTuple;		/* index of next one to return */
+	bool		eof;			/* true if the enclave has no more tuples */
 
 	char	   *searchValue;
 	/* currently we are assuming saerchees over char types.Encrypted blocks */
@@ -41,6 +58,51 @@ typedef struct OblivScanState
 
 	Oid			opno;
 
+	/*
+	 * Scan keys on the indexed column, evaluated when the scan starts and
+	 * on every rescan, in keyContext.
+	 */
+	List	   *scanKeys;
+	bool		keysReady;		/* scanKeys evaluated for the current scan */
+	bool		newScan;		/* next enclave call starts a new scan */
+	MemoryContext keyContext;
+	Oid			opfamily;		/* btree operator family of the mirror index */
+	Oid			opcintype;		/* type of the indexed column */
+	FmgrInfo	cmpProc;		/* BTORDER_PROC of the indexed column */
+
+	/*
+	 * Range scan over the leaves of the oblivious B+tree, used when the
+	 * clauses only bound the indexed column.
+	 */
+	bool		isRange;
+	char	   *lowKey;
+	int			lowKeySize;
+	char	   *highKey;
+	int			highKeySize;
+	int			rangeFlags;		/* OBLIV_RANGE_* flags */
+
+	/*
+	 * Multi-key lookup of an IN list or = ANY (array) on the indexed column.
+	 * The keys are concatenated in multiKeys, key i having length
+	 * multiKeyLengths[i].
+	 */
+	bool		isMulti;
+	char	   *multiKeys;
+	int			multiKeysSize;
+	int		   *multiKeyLengths;
+	int			numMultiKeys;
+
+	/*
+	 * LIMIT pushed down by the planner. The enclave is never asked for more
+	 * tuples, which bounds the ORAM accesses of top-N queries.
+	 */
+	int64		maxTuples;		/* -1 if the scan is not limited */
+	int64		returnedTuples; /* tuples received from the enclave */
+
+	/* EXPLAIN ANALYZE counters of the ecalls of the scan */
+	bool		instrumented;
+	OblivUsage	usage;
+
 } OblivScanState;
 
 
@@ -0,0 +1,208 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_capture.c
+ *	  capture of the block accesses requested by the enclave
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_capture.c
+ *
+ * When oblivpg_fdw.capture_file is set, the block ocalls append a record
+ * with the file id, block number, operation and size of every block the
+ * enclave reads or writes to the file <capture_file>.<pid> of the backend.
+ * The records are taken before the treetop cache and the lazy allocation
+ * filter the requests, so a capture holds the access pattern of the ORAM
+ * and not the I/O of one storage configuration. tools/obliv_replay plays a
+ * capture against the storage backends without SGX or a running server.
+ *
+ * The records are buffered and written when the buffer is full, when the
+ * ORAM files are synced or closed and when the backend exits.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "include/obliv_capture.h"
+#include "include/obliv_ocalls.h"
+
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "utils/memutils.h"
+
+#define CAPTURE_BUFFER_RECORDS 4096
+
+char	   *oblivCaptureFile = NULL;
+
+static int	captureFd = -1;
+static char *captureTarget = NULL;	/* value of capture_file for captureFd */
+static char *capturePath = NULL;
+static OblivCaptureRecord *captureBuffer = NULL;
+static int	captureUsed = 0;
+static bool captureExitRegistered = false;
+
+static void captureOpen(void);
+static void captureClose(int elevel);
+static void captureWrite(int elevel);
+static void captureAtExit(int code, Datum arg);
+
+/*
+ * Opens the capture file of the backend, writing the header when the file
+ * is new. The capture stays closed if either fails, so that no record is
+ * appended to a file without a header.
+ */
+static void
+captureOpen(void)
+{
+	char	   *path;
+	int			fd;
+	off_t		size;
+
+	path = psprintf("%s.%d", oblivCaptureFile, MyProcPid);
+
+	fd = BasicOpenFile(path, O_WRONLY | O_CREAT | O_APPEND | PG_BINARY);
+	if (fd < 0)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open capture file \"%s\": %m", path)));
+	}
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size == 0)
+	{
+		OblivCaptureHeader header;
+
+		header.magic = OBLIV_CAPTURE_MAGIC;
+		header.version = OBLIV_CAPTURE_VERSION;
+		header.recordSize = sizeof(OblivCaptureRecord);
+
+		if (write(fd, &header, sizeof(header)) != sizeof(header))
+		{
+			int			save_errno = errno;
+
+			close(fd);
+			errno = save_errno;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write capture file \"%s\": %m", path)));
+		}
+	}
+
+	if (captureBuffer == NULL)
+		captureBuffer = (OblivCaptureRecord *) MemoryContextAlloc(TopMemoryContext,
+																  sizeof(OblivCaptureRecord) * CAPTURE_BUFFER_RECORDS);
+	captureUsed = 0;
+
+	captureFd = fd;
+	captureTarget = MemoryContextStrdup(TopMemoryContext, oblivCaptureFile);
+	capturePath = MemoryContextStrdup(TopMemoryContext, path);
+	pfree(path);
+
+	if (!captureExitRegistered)
+	{
+		on_proc_exit(captureAtExit, (Datum) 0);
+		captureExitRegistered = true;
+	}
+
+	elog(DEBUG1, "Capturing the oblivious block accesses to %s", capturePath);
+}
+
+/*
+ * Flushes and closes the capture file, reporting a failed write at elevel.
+ */
+static void
+captureClose(int elevel)
+{
+	captureWrite(elevel);
+
+	close(captureFd);
+	captureFd = -1;
+
+	pfree(captureTarget);
+	pfree(capturePath);
+	captureTarget = NULL;
+	capturePath = NULL;
+}
+
+/*
+ * An ERROR cannot be raised while the backend exits, the records that
+ * could not be written are only reported.
+ */
+static void
+captureAtExit(int code, Datum arg)
+{
+	if (captureFd >= 0)
+		captureClose(WARNING);
+}
+
+/*
+ * Writes the buffered records to the capture file.
+ */
+void
+oblivCaptureFlush(void)
+{
+	captureWrite(ERROR);
+}
+
+static void
+captureWrite(int elevel)
+{
+	size_t		bytes;
+
+	if (captureFd < 0 || captureUsed == 0)
+		return;
+
+	bytes = sizeof(OblivCaptureRecord) * captureUsed;
+	captureUsed = 0;
+
+	if (write(captureFd, captureBuffer, bytes) != bytes)
+	{
+		ereport(elevel,
+				(errcode_for_file_access(),
+				 errmsg("could not write capture file \"%s\": %m", capturePath)));
+	}
+}
+
+/*
+ * Records the nblocks blocks of an ocall on ORAM file fileId.
+ */
+void
+oblivCaptureBlocks(int fileId, bool isWrite, const int *blknos, int nblocks, int pageSize)
+{
+	int			offset;
+
+	if (oblivCaptureFile == NULL || oblivCaptureFile[0] == '\0')
+	{
+		if (captureFd >= 0)
+			captureClose(ERROR);
+		return;
+	}
+
+	if (captureFd >= 0 && strcmp(captureTarget, oblivCaptureFile) != 0)
+		captureClose(ERROR);
+
+	if (captureFd < 0)
+		captureOpen();
+
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		OblivCaptureRecord *record;
+
+		if (captureUsed == CAPTURE_BUFFER_RECORDS)
+			oblivCaptureFlush();
+
+		record = &captureBuffer[captureUsed++];
+		record->blkno = (uint32) blknos[offset];
+		record->size = (uint32) pageSize;
+		record->fileId = (uint8) fileId;
+		record->op = isWrite ? OBLIV_CAPTURE_WRITE : OBLIV_CAPTURE_READ;
+		record->flags = offset > 0 ? OBLIV_CAPTURE_CONT : 0;
+	}
+}
@@ -0,0 +1,222 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_checkpoint.c
+ *	  code to store and load the sealed ORAM state of the enclave
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_checkpoint.c
+ *
+ * A checkpoint file lets a restarted server resume from the existing ORAM
+ * files without rebuilding them with load_blocks. The file is stored in the
+ * database directory of the tablespace of the mirror table, next to the
+ * ORAM relations.
+ *
+ * A checkpoint only matches the ORAM files as they were when it was taken.
+ * Every ORAM access rewrites a path, so the first write to the files after a
+ * checkpoint is stored or restored removes the checkpoint file. A server
+ * that crashes afterwards has to rebuild the files with load_blocks instead
+ * of resuming from a stale position map.
+ *
+ * INTERFACE ROUTINES
+ *		writeOblivState()			- durably store a sealed ORAM state
+ *		readOblivState()			- load a sealed ORAM state
+ *		discardOblivState()			- remove the checkpoint before the files change
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "include/obliv_checkpoint.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "miscadmin.h"
+#include "common/relpath.h"
+#include "storage/fd.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+/* Checkpoint file that still matches the ORAM files, if any. */
+static char *currentStatePath = NULL;
+
+static char *oblivStatePath(Oid ftwOid, Oid mirrorOid);
+static void setCurrentState(const char *path);
+
+static char *
+oblivStatePath(Oid ftwOid, Oid mirrorOid)
+{
+	Oid			spcOid;
+	char	   *dbPath;
+	char	   *path;
+
+	spcOid = get_rel_tablespace(mirrorOid);
+	if (spcOid == InvalidOid)
+		spcOid = MyDatabaseTableSpace;
+
+	dbPath = GetDatabasePath(MyDatabaseId, spcOid);
+	path = psprintf("%s/oblivpg_%u.state", dbPath, ftwOid);
+	pfree(dbPath);
+
+	return path;
+}
+
+static void
+setCurrentState(const char *path)
+{
+	if (currentStatePath != NULL)
+		pfree(currentStatePath);
+	currentStatePath = MemoryContextStrdup(TopMemoryContext, path);
+}
+
+/*
+ * Writes the checkpoint file of a foreign table. The file is written to a
+ * temporary file that replaces the previous checkpoint once it is on disk,
+ * so a crash never leaves a partial checkpoint behind.
+ */
+void
+writeOblivState(Oid ftwOid, Oid mirrorOid, OblivStateHeader *header, const char *sealed)
+{
+	char	   *path;
+	char	   *tmpPath;
+	int			fd;
+
+	path = oblivStatePath(ftwOid, mirrorOid);
+	tmpPath = psprintf("%s.tmp", path);
+
+	fd = OpenTransientFile(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+	if (fd < 0)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not create file \"%s\": %m", tmpPath)));
+	}
+
+	errno = 0;
+	if (write(fd, header, sizeof(OblivStateHeader)) != sizeof(OblivStateHeader) ||
+		write(fd, sealed, header->sealedSize) != header->sealedSize)
+	{
+		int			save_errno = errno;
+
+		CloseTransientFile(fd);
+		unlink(tmpPath);
+		/* if write didn't set errno, assume problem is no disk space */
+		errno = save_errno ? save_errno : ENOSPC;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write file \"%s\": %m", tmpPath)));
+	}
+
+	if (pg_fsync(fd) != 0)
+	{
+		int			save_errno = errno;
+
+		CloseTransientFile(fd);
+		errno = save_errno;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync file \"%s\": %m", tmpPath)));
+	}
+
+	CloseTransientFile(fd);
+
+	durable_rename(tmpPath, path, ERROR);
+	setCurrentState(path);
+
+	elog(DEBUG1, "Stored oblivious state of table %u with %u sealed bytes in %s",
+		 ftwOid, header->sealedSize, path);
+
+	pfree(tmpPath);
+	pfree(path);
+}
+
+/*
+ * Reads the checkpoint file of a foreign table and returns the sealed
+ * state, allocated in the current memory context.
+ */
+char *
+readOblivState(Oid ftwOid, Oid mirrorOid, OblivStateHeader *header)
+{
+	char	   *path;
+	char	   *sealed;
+	int			fd;
+	int			nread;
+
+	path = oblivStatePath(ftwOid, mirrorOid);
+
+	fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+	if (fd < 0)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", path)));
+	}
+
+	nread = read(fd, header, sizeof(OblivStateHeader));
+	if (nread != sizeof(OblivStateHeader))
+	{
+		CloseTransientFile(fd);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("could not read the header of oblivious state file \"%s\"", path)));
+	}
+
+	if (header->magic != OBLIV_STATE_MAGIC || header->version != OBLIV_STATE_VERSION ||
+		header->ftwOid != ftwOid)
+	{
+		CloseTransientFile(fd);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("oblivious state file \"%s\" is not a checkpoint of table %u", path, ftwOid)));
+	}
+
+	sealed = (char *) palloc(header->sealedSize);
+
+	nread = read(fd, sealed, header->sealedSize);
+	if (nread < 0 || (uint32) nread != header->sealedSize)
+	{
+		CloseTransientFile(fd);
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("oblivious state file \"%s\" is truncated", path)));
+	}
+
+	CloseTransientFile(fd);
+
+	setCurrentState(path);
+	pfree(path);
+
+	return sealed;
+}
+
+/*
+ * Removes the current checkpoint file. Called before the ORAM files are
+ * modified; the removal is made durable before the write is issued.
+ */
+void
+discardOblivState(void)
+{
+	char	   *dirPath;
+
+	if (currentStatePath == NULL)
+		return;
+
+	if (unlink(currentStatePath) < 0 && errno != ENOENT)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not remove file \"%s\": %m", currentStatePath)));
+	}
+
+	dirPath = pstrdup(currentStatePath);
+	get_parent_directory(dirPath);
+	fsync_fname(dirPath, true);
+	pfree(dirPath);
+
+	elog(DEBUG1, "Removed oblivious state file %s", currentStatePath);
+
+	pfree(currentStatePath);
+	currentStatePath = NULL;
+}
@@ -0,0 +1,128 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_cost.c
+ *	  planner cost model of the oblivious scans
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_cost.c
+ *
+ * The cost of an oblivious scan does not depend on where the tuples are
+ * stored, only on the number of ORAM accesses. Every access reads a whole
+ * path of the tree with outFileReadv and writes it back with outFileWritev,
+ * so it costs two ocalls and twice the blocks of a path. A path of an ORAM
+ * file of N blocks has ceil(log2(N)) + 1 buckets of OBLIV_BUCKET_CAPACITY
+ * blocks.
+ *
+ * A lookup on a B+tree mirror index accesses the index ORAM once per level
+ * of the tree and the heap ORAM once per tuple, and a lookup on a hash
+ * index accesses a single bucket of the index. The enclave pads every
+ * lookup to at least one heap access. The tuples are returned by one ecall
+ * per batch of OBLIV_TUPLE_BATCH_SIZE tuples.
+ *
+ * The unit costs are in the units of the planner. They can be measured on
+ * the host with obliv_calibrate().
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "include/obliv_cost.h"
+#include "include/oblivpg_fdw.h"
+
+#include <math.h>
+
+#include "catalog/pg_am.h"
+#include "optimizer/cost.h"
+
+/* Cost of an enclave transition issued by a scan */
+double		oblivEcallCost = 2.0;
+
+/* Cost of an ocall issued by the enclave */
+double		oblivOcallCost = 2.0;
+
+/* Cost of reading or writing an ORAM block */
+double		oblivBlockCost = 1.0;
+
+static double pathBlocks(int nblocks);
+static Cost accessCost(double blocks);
+
+static double
+pathBlocks(int nblocks)
+{
+	return (ceil(log2((double) Max(nblocks, 1))) + 1) * OBLIV_BUCKET_CAPACITY;
+}
+
+/*
+ * Cost of an ORAM access to a file whose paths have the given number of
+ * blocks: the path is read and evicted in two ocalls.
+ */
+static Cost
+accessCost(double blocks)
+{
+	return 2 * blocks * oblivBlockCost + 2 * oblivOcallCost;
+}
+
+/*
+ * Sets the ORAM geometry of the heap and index files of a foreign table
+ * from the sizes of its mapping row and the height of its mirror index.
+ */
+void
+oblivSetGeometry(OblivRelInfo *relInfo)
+{
+	FdwOblivTableStatus *status = &relInfo->table.status;
+
+	relInfo->heapPathBlocks = pathBlocks(status->tableNBlocks);
+	relInfo->indexPathBlocks = pathBlocks(status->indexNBlocks);
+
+	if (relInfo->table.indexAm == BTREE_AM_OID)
+		relInfo->indexLevels = relInfo->table.indexTreeHeight + 1;
+	else
+		relInfo->indexLevels = 1;
+}
+
+/*
+ * Estimates the costs of a scan of the given shape that returns rows
+ * tuples. nkeys is the number of lookups of a multi-key scan.
+ */
+void
+oblivEstimateCosts(RelOptInfo *baserel, OblivRelInfo *relInfo, int scanShape,
+				   double nkeys, double rows, Cost *startupCost, Cost *totalCost)
+{
+	Cost		heapAccess = accessCost(relInfo->heapPathBlocks);
+	Cost		indexAccess = accessCost(relInfo->indexPathBlocks);
+	Cost		descent = relInfo->indexLevels * indexAccess;
+	Cost		startup;
+	Cost		run;
+	double		ecalls;
+
+	startup = baserel->baserestrictcost.startup + oblivEcallCost;
+
+	switch (scanShape)
+	{
+		case OBLIV_SCAN_LOOKUP:
+			startup += descent;
+			run = Max(rows, 1.0) * heapAccess;
+			break;
+		case OBLIV_SCAN_RANGE:
+			/* one leaf access for each tuple of the leaf walk */
+			startup += descent;
+			run = rows * (indexAccess + heapAccess);
+			break;
+		case OBLIV_SCAN_MULTI:
+			run = nkeys * descent + Max(rows, nkeys) * heapAccess;
+			break;
+		default:
+			run = relInfo->table.status.tableNBlocks * heapAccess;
+			break;
+	}
+
+	/* the first ecall is part of the startup cost */
+	ecalls = floor(rows / OBLIV_TUPLE_BATCH_SIZE);
+	run += ecalls * oblivEcallCost;
+	run += (cpu_tuple_cost + baserel->baserestrictcost.per_tuple) * rows;
+
+	*startupCost = startup;
+	*totalCost = startup + run;
+}
@@ -0,0 +1,207 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_instrument.c
+ *	  counters of the enclave transitions and of the ORAM block I/O
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_instrument.c
+ *
+ * The ecalls of the scans and inserts and the block ocalls update the
+ * counters of oblivUsage and the shared statistics of the table. The time
+ * spent in them is only measured while oblivTrackTiming is set, which
+ * EXPLAIN ANALYZE does for the ecalls of the instrumented scans, or when the
+ * shared statistics or the trace are enabled.
+ *
+ * The same calls report the wait events of the backend: ObliviousEcall
+ * while it is inside the enclave, and ObliviousPathRead or
+ * ObliviousEviction while the enclave waits for a block ocall. The event of
+ * an ocall replaces the event of its ecall, which is restored when the
+ * ocall returns. Before PostgreSQL 17 the extensions cannot name their wait
+ * events, so the three events are shown as Extension.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "include/obliv_instrument.h"
+#include "include/obliv_stats.h"
+#include "include/obliv_trace.h"
+
+#include "pgstat.h"
+#include "storage/proc.h"
+
+OblivUsage	oblivUsage;
+
+bool		oblivTrackTiming = false;
+
+#define TIMING_ENABLED() (oblivTrackTiming || oblivStatsEnabled() || oblivTraceEnabled())
+
+/* Foreign table of the current ecall */
+static Oid	ecallTable = InvalidOid;
+
+/* Wait events reported before the current ecall and ocall */
+static uint32 ecallSavedWait = 0;
+static uint32 ocallSavedWait = 0;
+
+#if PG_VERSION_NUM >= 170000
+static uint32 oblivWaitEvents[OBLIV_WAIT_NEVENTS];
+static const char *const oblivWaitNames[OBLIV_WAIT_NEVENTS] = {
+	"ObliviousEcall",
+	"ObliviousPathRead",
+	"ObliviousEviction"
+};
+#endif
+
+/*
+ * Reports a wait event of the extension and returns the wait event it
+ * replaces, to be given to oblivWaitEnd.
+ */
+uint32
+oblivWaitStart(int event)
+{
+	uint32		saved;
+	uint32		waitEventInfo;
+
+#if PG_VERSION_NUM >= 140000
+	saved = *my_wait_event_info;
+#else
+	saved = MyProc != NULL ? MyProc->wait_event_info : 0;
+#endif
+
+#if PG_VERSION_NUM >= 170000
+	if (oblivWaitEvents[event] == 0)
+		oblivWaitEvents[event] = WaitEventExtensionNew(oblivWaitNames[event]);
+	waitEventInfo = oblivWaitEvents[event];
+#else
+	waitEventInfo = PG_WAIT_EXTENSION | event;
+#endif
+
+	pgstat_report_wait_start(waitEventInfo);
+
+	return saved;
+}
+
+/*
+ * Restores the wait event replaced by oblivWaitStart.
+ */
+void
+oblivWaitEnd(uint32 saved)
+{
+	if (saved != 0)
+		pgstat_report_wait_start(saved);
+	else
+		pgstat_report_wait_end();
+}
+
+/*
+ * Counts an ecall on a foreign table and starts its timer.
+ */
+void
+oblivEcallStart(instr_time *start, Oid ftwOid)
+{
+	oblivUsage.ecalls++;
+	ecallTable = ftwOid;
+	oblivStatsBeginEcall(ftwOid);
+	ecallSavedWait = oblivWaitStart(OBLIV_WAIT_ECALL);
+
+	if (TIMING_ENABLED())
+		INSTR_TIME_SET_CURRENT(*start);
+}
+
+/*
+ * Ends the timer of an ecall of type op (OBLIV_STAT_ECALL_*) that copied
+ * bytes across the boundary, the buffers of its arguments and results.
+ */
+void
+oblivEcallEnd(instr_time *start, int op, int64 bytes)
+{
+	instr_time	duration;
+
+	oblivWaitEnd(ecallSavedWait);
+	oblivUsage.bytesCrossed += bytes;
+
+	INSTR_TIME_SET_ZERO(duration);
+	if (TIMING_ENABLED())
+	{
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, *start);
+		INSTR_TIME_ADD(oblivUsage.enclaveTime, duration);
+	}
+
+	oblivStatsEndEcall(op, INSTR_TIME_GET_DOUBLE(duration) * 1000000.0, bytes);
+	oblivTraceSpan(op == OBLIV_STAT_ECALL_SCAN ? OBLIV_TRACE_ECALL_SCAN : OBLIV_TRACE_ECALL_INSERT,
+				   ecallTable, -1, -1, 0, start, &duration);
+}
+
+void
+oblivOcallStart(instr_time *start, bool isWrite)
+{
+	ocallSavedWait = oblivWaitStart(isWrite ? OBLIV_WAIT_EVICTION : OBLIV_WAIT_PATH_READ);
+
+	if (TIMING_ENABLED())
+		INSTR_TIME_SET_CURRENT(*start);
+}
+
+/*
+ * Counts a block ocall on the ORAM file of relation relId and ends its
+ * timer. blkno is the first block of the ocall.
+ */
+void
+oblivOcallEnd(instr_time *start, int fileId, Oid relId, bool isWrite, int blkno,
+			  int nblocks, int64 bytes)
+{
+	instr_time	duration;
+
+	oblivWaitEnd(ocallSavedWait);
+
+	if (isWrite)
+		oblivUsage.ocallWrites++;
+	else
+		oblivUsage.ocallReads++;
+
+	if (fileId >= 0 && fileId < OBLIV_USAGE_FILES)
+	{
+		if (isWrite)
+			oblivUsage.blocksWritten[fileId] += nblocks;
+		else
+			oblivUsage.blocksRead[fileId] += nblocks;
+	}
+
+	oblivUsage.bytesCrossed += bytes;
+
+	INSTR_TIME_SET_ZERO(duration);
+	if (TIMING_ENABLED())
+	{
+		INSTR_TIME_SET_CURRENT(duration);
+		INSTR_TIME_SUBTRACT(duration, *start);
+		INSTR_TIME_ADD(oblivUsage.ioTime, duration);
+	}
+
+	oblivStatsOcall(isWrite ? OBLIV_STAT_OCALL_WRITE : OBLIV_STAT_OCALL_READ,
+					nblocks, bytes, INSTR_TIME_GET_DOUBLE(duration) * 1000000.0);
+	oblivTraceSpan(isWrite ? OBLIV_TRACE_WRITE : OBLIV_TRACE_READ,
+				   relId, fileId, blkno, nblocks, start, &duration);
+}
+
+/*
+ * dst += add - sub, as done by BufferUsageAccumDiff.
+ */
+void
+oblivUsageAccumDiff(OblivUsage *dst, const OblivUsage *add, const OblivUsage *sub)
+{
+	int			i;
+
+	dst->ecalls += add->ecalls - sub->ecalls;
+	dst->ocallReads += add->ocallReads - sub->ocallReads;
+	dst->ocallWrites += add->ocallWrites - sub->ocallWrites;
+	for (i = 0; i < OBLIV_USAGE_FILES; i++)
+	{
+		dst->blocksRead[i] += add->blocksRead[i] - sub->blocksRead[i];
+		dst->blocksWritten[i] += add->blocksWritten[i] - sub->blocksWritten[i];
+	}
+	dst->bytesCrossed += add->bytesCrossed - sub->bytesCrossed;
+	INSTR_TIME_ACCUM_DIFF(dst->enclaveTime, add->enclaveTime, sub->enclaveTime);
+	INSTR_TIME_ACCUM_DIFF(dst->ioTime, add->ioTime, sub->ioTime);
+}
@@ -0,0 +1,212 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_mmap.c
+ *	  memory-mapped storage backend for the ORAM files
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_mmap.c
+ *
+ * For ORAM relations that fit in memory, the segment files are mapped once
+ * on the first access after the file initialization. A block access is then
+ * a bounds check and a copy between the mapping and the enclave buffer, with
+ * no buffer lookups, pins or dirty marking. The mappings are written back
+ * with msync by obliv_sync() and when the files are closed.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "include/obliv_storage.h"
+
+#include "storage/bufpage.h"
+#include "utils/memutils.h"
+
+typedef struct MmapFile
+{
+	OblivSegments segs;
+	char	  **maps;			/* mapping of each segment file */
+} MmapFile;
+
+static void mmapAttach(OblivFile *file);
+static void mmapDetach(OblivFile *file);
+static void mmapCheckPageSize(int pageSize);
+static void mmapReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize);
+static void mmapWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize);
+static void mmapPrefetch(OblivFile *file, const int *blknos, int nblocks);
+static void mmapSync(OblivFile *file);
+
+const OblivStorageRoutine oblivMmapStorage = {
+	"mmap",
+	mmapAttach,
+	mmapDetach,
+	mmapReadv,
+	mmapWritev,
+	mmapPrefetch,
+	mmapSync,
+	NULL,
+	NULL
+};
+
+static inline size_t
+segmentSize(OblivSegments *segs, int seg)
+{
+	BlockNumber segBlocks = Min(segs->nblocks - (BlockNumber) seg * RELSEG_SIZE, RELSEG_SIZE);
+
+	return (size_t) segBlocks * BLCKSZ;
+}
+
+static inline char *
+mmapBlock(OblivFile *file, MmapFile *mfile, int blkno)
+{
+	if (blkno < 0 || (BlockNumber) blkno >= mfile->segs.nblocks)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("Enclave requested block %d of oblivious file %s with %u blocks",
+						blkno, file->name, mfile->segs.nblocks)));
+	}
+
+	return mfile->maps[blkno / RELSEG_SIZE] + ((size_t) (blkno % RELSEG_SIZE) * BLCKSZ);
+}
+
+static void
+mmapAttach(OblivFile *file)
+{
+	MmapFile   *mfile;
+	int			seg;
+
+	oblivDropBuffers(file);
+
+	mfile = (MmapFile *) MemoryContextAllocZero(TopMemoryContext, sizeof(MmapFile));
+	oblivOpenSegments(file, O_RDWR | PG_BINARY, &mfile->segs);
+	mfile->maps = (char **) MemoryContextAllocZero(TopMemoryContext,
+												   sizeof(char *) * Max(mfile->segs.nsegs, 1));
+
+	for (seg = 0; seg < mfile->segs.nsegs; seg++)
+	{
+		void	   *map;
+
+		map = mmap(NULL, segmentSize(&mfile->segs, seg), PROT_READ | PROT_WRITE,
+				   MAP_SHARED, mfile->segs.fds[seg], 0);
+
+		if (map == MAP_FAILED)
+		{
+			int			save_errno = errno;
+
+			while (--seg >= 0)
+				munmap(mfile->maps[seg], segmentSize(&mfile->segs, seg));
+			oblivCloseSegments(file, &mfile->segs);
+			pfree(mfile->maps);
+			pfree(mfile);
+
+			errno = save_errno;
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("could not map oblivious file %s: %m", file->name)));
+		}
+		mfile->maps[seg] = (char *) map;
+	}
+
+	file->storagePrivate = mfile;
+
+	elog(DEBUG1, "mmap storage attached to %s with %u blocks", file->name, mfile->segs.nblocks);
+}
+
+static void
+mmapDetach(OblivFile *file)
+{
+	MmapFile   *mfile = (MmapFile *) file->storagePrivate;
+	int			seg;
+
+	mmapSync(file);
+
+	for (seg = 0; seg < mfile->segs.nsegs; seg++)
+		munmap(mfile->maps[seg], segmentSize(&mfile->segs, seg));
+
+	oblivCloseSegments(file, &mfile->segs);
+	pfree(mfile->maps);
+	pfree(mfile);
+}
+
+/*
+ * A page is copied from or to a single block of the mapping.
+ */
+static void
+mmapCheckPageSize(int pageSize)
+{
+	if (pageSize > BLCKSZ)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("mmap storage accesses at most a block, requested %d bytes",
+						pageSize)));
+	}
+}
+
+static void
+mmapReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize)
+{
+	MmapFile   *mfile = (MmapFile *) file->storagePrivate;
+	int			offset;
+
+	mmapCheckPageSize(pageSize);
+
+	for (offset = 0; offset < nblocks; offset++)
+		memcpy(pages + (offset * pageSize), mmapBlock(file, mfile, blknos[offset]), pageSize);
+}
+
+static void
+mmapWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize)
+{
+	MmapFile   *mfile = (MmapFile *) file->storagePrivate;
+	int			offset;
+
+	mmapCheckPageSize(pageSize);
+
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		char	   *block = mmapBlock(file, mfile, blknos[offset]);
+
+		memcpy(block, pages + (offset * pageSize), pageSize);
+		PageSetChecksumInplace((Page) block, blknos[offset]);
+	}
+}
+
+static void
+mmapPrefetch(OblivFile *file, const int *blknos, int nblocks)
+{
+	MmapFile   *mfile = (MmapFile *) file->storagePrivate;
+	int			offset;
+
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		if (blknos[offset] < 0 || (BlockNumber) blknos[offset] >= mfile->segs.nblocks)
+			continue;
+
+		(void) madvise(mmapBlock(file, mfile, blknos[offset]), BLCKSZ, MADV_WILLNEED);
+	}
+}
+
+static void
+mmapSync(OblivFile *file)
+{
+	MmapFile   *mfile = (MmapFile *) file->storagePrivate;
+	int			seg;
+
+	for (seg = 0; seg < mfile->segs.nsegs; seg++)
+	{
+		if (msync(mfile->maps[seg], segmentSize(&mfile->segs, seg), MS_SYNC) != 0)
+		{
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not msync oblivious file %s: %m", file->name)));
+		}
+	}
+}
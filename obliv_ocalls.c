@@ -5,6 +5,19 @@
 #include "access/hash.h"
 #include "access/heapam.h"
 
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "common/relpath.h"
+#include "storage/bufmgr.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lmgr.h"
+#include "storage/lwlock.h"
 #include "storage/smgr.h"
 #include "storage/bufpage.h"
 
@@ -12,8 +25,15 @@
 #include "include/oblivpg_fdw.h"
 #include "include/obliv_status.h"
 #include "include/obliv_ocalls.h"
+#include "include/obliv_storage.h"
+#include "include/obliv_checkpoint.h"
+#include "include/obliv_treetop.h"
+#include "include/obliv_instrument.h"
+#include "include/obliv_probes.h"
 
 #include "utils/fmgroids.h"
+#include "utils/memutils.h"
+#include "utils/resowner.h"
 
 #ifndef UNSAFE
 #include "Enclave_u.h"
@@ -36,14 +56,86 @@ typedef struct SoeHashPageOpaqueData
 typedef SoeHashPageOpaqueData * SoeHashPageOpaque;
 
 
-
 #define SOE_CONTEXT "SOE_CONTEXT"
 
 FdwOblivTableStatus status;
-char	   *tableName = "mirror_usertable";
-char	   *indexName = "mirror_usertable_key";
 Oid			ihOID;
 
+/* Per-backend registry of the ORAM files, indexed by file id. */
+static OblivFile oblivFiles[OBLIV_NFILES];
+
+/*
+ * Resource owner of the registry relations. It is not tied to any
+ * transaction, so the relcache references survive the end of init_soe.
+ */
+static ResourceOwner oblivFilesOwner = NULL;
+static bool oblivFilesExitRegistered = false;
+
+/* Storage backend assigned to the files registered by the next init_soe. */
+int			oblivStorageKind = OBLIV_STORAGE_BUFMGR;
+
+/* Open the ORAM files with O_DIRECT on the backends that own the files. */
+bool		oblivDirectIO = false;
+
+const struct config_enum_entry oblivStorageOptions[] = {
+	{"bufmgr", OBLIV_STORAGE_BUFMGR, false},
+#ifdef OBLIV_URING
+	{"uring", OBLIV_STORAGE_URING, false},
+#endif
+	{"mmap", OBLIV_STORAGE_MMAP, false},
+	{"remote", OBLIV_STORAGE_REMOTE, false},
+	{NULL, 0, false}
+};
+
+/*
+ * Storage latency injected on the blocks that reach the storage backend:
+ * a delay in microseconds per round trip, drawn from a distribution of mean
+ * oblivInjectLatency, and a bandwidth cap in kB/s. The blocks of a request
+ * are sent inject_queue_depth at a time, each group waiting for its slowest
+ * block.
+ */
+int			oblivInjectLatency = 0;
+int			oblivInjectDistribution = OBLIV_INJECT_FIXED;
+int			oblivInjectQueueDepth = 1;
+int			oblivInjectBandwidth = 0;
+
+const struct config_enum_entry oblivInjectOptions[] = {
+	{"fixed", OBLIV_INJECT_FIXED, false},
+	{"uniform", OBLIV_INJECT_UNIFORM, false},
+	{"exponential", OBLIV_INJECT_EXPONENTIAL, false},
+	{NULL, 0, false}
+};
+
+static void registerOblivFile(int fileId, const char *name, Oid relId, bool isIndex);
+static void unregisterOblivFile(int fileId);
+static OblivFile *getOblivFile(int fileId);
+static int	lookupOblivFile(const char *filename);
+static void readOblivBlock(OblivFile *file, BlockNumber blkno, char *page, int pageSize);
+static void writeOblivBlock(OblivFile *file, BlockNumber blkno, const char *page, int pageSize);
+static void prefetchOblivBlocks(OblivFile *file, const int *blknos, int nblocks);
+static void detachOblivFile(OblivFile *file);
+static void oblivFilesAtExit(int code, Datum arg);
+static void finishOblivInit(OblivFile *file);
+static void readOblivBlocks(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize);
+static void writeOblivBlocks(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize);
+static void bufmgrReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize);
+static void bufmgrWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize);
+static void bufmgrSync(OblivFile *file);
+static void injectStorageDelay(int nblocks, int pageSize);
+
+/* Storage backend that reads and writes the files through shared buffers. */
+const OblivStorageRoutine oblivBufmgrStorage = {
+	"bufmgr",
+	NULL,
+	NULL,
+	bufmgrReadv,
+	bufmgrWritev,
+	prefetchOblivBlocks,
+	bufmgrSync,
+	NULL,
+	NULL
+};
+
 void
 oc_logger(const char *str)
 {
@@ -54,7 +146,8 @@ oc_logger(const char *str)
 void
 print_status()
 {
-	elog(DEBUG1, "tableName is %s and indexName is %s ", tableName, indexName);
+	elog(DEBUG1, "tableName is %s and indexName is %s ",
+		 oblivFiles[OBLIV_HEAP_FILE].name, oblivFiles[OBLIV_INDEX_FILE].name);
 }
 
 void
@@ -68,16 +161,555 @@ setupOblivStatus(FdwOblivTableStatus instatus, const char *tbName, const char *i
 	status.tableNBlocks = instatus.tableNBlocks;
 
 	ihOID = indexHandlerOID;
-	//tableName = (char *) palloc(strlen(tbName) + 1);
-	//indexName = (char *) palloc(strlen(idName) + 1);
-    //memcpy(tableName, tbName, strlen(tbName) + 1);
-	//memcpy(indexName, idName, strlen(idName) + 1);
+
+	/* A new initialization replaces the files of a previous one. */
+	closeOblivStatus();
+
+	registerOblivFile(OBLIV_HEAP_FILE, tbName, status.relTableMirrorId, false);
+	registerOblivFile(OBLIV_INDEX_FILE, idName, status.relIndexMirrorId, true);
 }
+
 void
 closeOblivStatus()
 {
-	pfree(tableName);
-	pfree(indexName);
+	int			fileId;
+
+	oblivCaptureFlush();
+
+	for (fileId = 0; fileId < OBLIV_NFILES; fileId++)
+		unregisterOblivFile(fileId);
+}
+
+/*
+ * Opens the relation of an ORAM file and keeps it open in the registry.
+ *
+ * The relation is locked at session level, which keeps the lock across
+ * transactions until the file is unregistered.
+ */
+static void
+registerOblivFile(int fileId, const char *name, Oid relId, bool isIndex)
+{
+	OblivFile  *file = &oblivFiles[fileId];
+	ResourceOwner oldOwner;
+	LockRelId	lockRelId;
+
+	if (relId == InvalidOid)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("Oblivious table with name %s does not exist in the database",
+						name)));
+	}
+
+	if (oblivFilesOwner == NULL)
+		oblivFilesOwner = ResourceOwnerCreate(NULL, "oblivpg_fdw files");
+
+	if (!oblivFilesExitRegistered)
+	{
+		before_shmem_exit(oblivFilesAtExit, (Datum) 0);
+		oblivFilesExitRegistered = true;
+	}
+
+	lockRelId.relId = relId;
+	lockRelId.dbId = MyDatabaseId;
+	LockRelationIdForSession(&lockRelId, RowExclusiveLock);
+
+	oldOwner = CurrentResourceOwner;
+	CurrentResourceOwner = oblivFilesOwner;
+	file->rel = RelationIdGetRelation(relId);
+	CurrentResourceOwner = oldOwner;
+
+	if (!RelationIsValid(file->rel))
+	{
+		UnlockRelationIdForSession(&lockRelId, RowExclusiveLock);
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("could not open relation with OID %u for oblivious file %s",
+						relId, name)));
+	}
+
+	/*
+	 * rd_smgr can be reset by a relcache invalidation, ReadBuffer reopens it
+	 * when needed.
+	 */
+	RelationOpenSmgr(file->rel);
+
+	file->name = MemoryContextStrdup(TopMemoryContext, name);
+	file->relId = relId;
+	file->isIndex = isIndex;
+	file->attached = false;
+	file->storagePrivate = NULL;
+	file->initInProgress = false;
+	file->initNext = 0;
+	file->lazyWritten = NULL;
+	file->lazyBlocks = 0;
+	file->treetopSlot = -1;
+
+	switch (oblivStorageKind)
+	{
+#ifdef OBLIV_URING
+		case OBLIV_STORAGE_URING:
+			file->storage = &oblivUringStorage;
+			break;
+#endif
+		case OBLIV_STORAGE_MMAP:
+			file->storage = &oblivMmapStorage;
+			break;
+		case OBLIV_STORAGE_REMOTE:
+			file->storage = &oblivRemoteStorage;
+			break;
+		default:
+			file->storage = &oblivBufmgrStorage;
+			break;
+	}
+
+	elog(DEBUG1, "Registered oblivious file %s with storage %s", name, file->storage->name);
+}
+
+static void
+unregisterOblivFile(int fileId)
+{
+	OblivFile  *file = &oblivFiles[fileId];
+	ResourceOwner oldOwner;
+	LockRelId	lockRelId;
+
+	if (file->rel == NULL)
+		return;
+
+	finishOblivInit(file);
+	detachOblivFile(file);
+
+	lockRelId = file->rel->rd_lockInfo.lockRelId;
+
+	oldOwner = CurrentResourceOwner;
+	CurrentResourceOwner = oblivFilesOwner;
+	RelationClose(file->rel);
+	CurrentResourceOwner = oldOwner;
+
+	UnlockRelationIdForSession(&lockRelId, RowExclusiveLock);
+
+	if (file->lazyWritten != NULL)
+		pfree(file->lazyWritten);
+	file->lazyWritten = NULL;
+	file->lazyBlocks = 0;
+
+	pfree(file->name);
+	file->name = NULL;
+	file->rel = NULL;
+	file->relId = InvalidOid;
+}
+
+static OblivFile *
+getOblivFile(int fileId)
+{
+	if (fileId < 0 || fileId >= OBLIV_NFILES || oblivFiles[fileId].rel == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("Enclave requested oblivious file %d that is not registered",
+						fileId)));
+	}
+
+	finishOblivInit(&oblivFiles[fileId]);
+
+	/* The storage takes over the file on the first access after its init. */
+	if (!oblivFiles[fileId].attached)
+	{
+		if (oblivFiles[fileId].storage->attach != NULL)
+			oblivFiles[fileId].storage->attach(&oblivFiles[fileId]);
+		oblivFiles[fileId].attached = true;
+		oblivTreetopAcquire(&oblivFiles[fileId]);
+	}
+
+	return &oblivFiles[fileId];
+}
+
+static void
+detachOblivFile(OblivFile *file)
+{
+	if (!file->attached)
+		return;
+
+	/* The cached top levels are written back before the storage goes away. */
+	oblivTreetopRelease(file);
+
+	if (file->storage->detach != NULL)
+		file->storage->detach(file);
+
+	file->attached = false;
+	file->storagePrivate = NULL;
+}
+
+/*
+ * Writes back the treetop blocks of the files and releases their cache
+ * entries when the backend exits without close_enclave, as the entries are
+ * shared by all the backends. A failed write-back is only reported and the
+ * blocks of the entry are dropped.
+ */
+static void
+oblivFilesAtExit(int code, Datum arg)
+{
+	int			fileId;
+
+	/* A FATAL error can exit while holding the cache locks. */
+	LWLockReleaseAll();
+
+	for (fileId = 0; fileId < OBLIV_NFILES; fileId++)
+	{
+		OblivFile  *file = &oblivFiles[fileId];
+
+		if (file->rel == NULL || file->treetopSlot < 0)
+			continue;
+
+		PG_TRY();
+		{
+			oblivTreetopFlush(file);
+		}
+		PG_CATCH();
+		{
+			EmitErrorReport();
+			FlushErrorState();
+			LWLockReleaseAll();
+			oblivTreetopInvalidate(file);
+		}
+		PG_END_TRY();
+
+		oblivTreetopRelease(file);
+	}
+}
+
+/*
+ * Only used by the ocalls that are issued once per file, such as the file
+ * initialization. Block accesses use the file id directly.
+ */
+static int
+lookupOblivFile(const char *filename)
+{
+	int			fileId;
+
+	for (fileId = 0; fileId < OBLIV_NFILES; fileId++)
+	{
+		if (oblivFiles[fileId].rel != NULL && strcmp(filename, oblivFiles[fileId].name) == 0)
+			return fileId;
+	}
+
+	ereport(ERROR,
+			(errcode(ERRCODE_UNDEFINED_OBJECT),
+			 errmsg("Enclave requested oblivious file %s that is not registered",
+					filename)));
+	return -1;
+}
+
+/*
+ * Makes the block writes of every registered ORAM file durable.
+ */
+void
+syncOblivFiles()
+{
+	int			fileId;
+
+	oblivCaptureFlush();
+
+	for (fileId = 0; fileId < OBLIV_NFILES; fileId++)
+	{
+		OblivFile  *file = &oblivFiles[fileId];
+
+		if (file->rel != NULL)
+			finishOblivInit(file);
+
+		if (file->rel != NULL && file->attached)
+			oblivTreetopFlush(file);
+
+		if (file->rel != NULL && file->attached && file->storage->sync != NULL)
+			file->storage->sync(file);
+	}
+}
+
+/*
+ * Writes the dirty buffers of an ORAM file and evicts its blocks from
+ * shared buffers. Used by the backends that access the segment files
+ * directly, so that the buffer manager never holds a stale copy.
+ */
+void
+oblivDropBuffers(OblivFile *file)
+{
+	FlushRelationBuffers(file->rel);
+	RelationOpenSmgr(file->rel);
+	DropRelFileNodeBuffers(file->rel->rd_smgr->smgr_rnode, MAIN_FORKNUM, 0);
+}
+
+/*
+ * Opens every segment file of the main fork of an ORAM file.
+ */
+void
+oblivOpenSegments(OblivFile *file, int flags, OblivSegments *segs)
+{
+	char	   *path;
+	int			seg;
+
+	segs->nblocks = RelationGetNumberOfBlocks(file->rel);
+	segs->nsegs = (segs->nblocks + RELSEG_SIZE - 1) / RELSEG_SIZE;
+	segs->fds = (int *) MemoryContextAlloc(TopMemoryContext, sizeof(int) * Max(segs->nsegs, 1));
+
+	path = relpath(file->rel->rd_node, MAIN_FORKNUM);
+
+	for (seg = 0; seg < segs->nsegs; seg++)
+	{
+		char	   *segPath;
+
+		if (seg == 0)
+			segPath = pstrdup(path);
+		else
+			segPath = psprintf("%s.%d", path, seg);
+
+		segs->fds[seg] = BasicOpenFile(segPath, flags);
+
+		if (segs->fds[seg] < 0)
+		{
+			int			save_errno = errno;
+
+			while (--seg >= 0)
+				close(segs->fds[seg]);
+			pfree(segs->fds);
+			segs->fds = NULL;
+
+			errno = save_errno;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not open oblivious file \"%s\": %m", segPath)));
+		}
+		pfree(segPath);
+	}
+
+	pfree(path);
+}
+
+/*
+ * Flushes the segment files of an ORAM file to disk and closes them.
+ */
+void
+oblivCloseSegments(OblivFile *file, OblivSegments *segs)
+{
+	int			seg;
+	bool		failed = false;
+
+	for (seg = 0; seg < segs->nsegs; seg++)
+	{
+		if (pg_fsync(segs->fds[seg]) != 0)
+			failed = true;
+		close(segs->fds[seg]);
+	}
+
+	pfree(segs->fds);
+	segs->fds = NULL;
+	segs->nsegs = 0;
+
+	if (failed)
+	{
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not fsync oblivious file %s: %m", file->name)));
+	}
+}
+
+/*
+ * Starts the initialization stream of an ORAM file.
+ *
+ * The initial pages are never loaded in shared buffers, so any buffered copy
+ * of the relation is flushed and dropped first. The buffer manager would
+ * otherwise return a stale version of an overwritten block. The same holds
+ * for the blocks of the treetop cache.
+ */
+static void
+beginOblivInit(OblivFile *file)
+{
+	discardOblivState();
+
+	/* The storage takes over the file again after its initialization. */
+	detachOblivFile(file);
+	oblivTreetopInvalidate(file);
+
+	FlushRelationBuffers(file->rel);
+	RelationOpenSmgr(file->rel);
+	DropRelFileNodeBuffers(file->rel->rd_smgr->smgr_rnode, MAIN_FORKNUM, 0);
+
+	if (file->lazyWritten != NULL)
+	{
+		pfree(file->lazyWritten);
+		file->lazyWritten = NULL;
+		file->lazyBlocks = 0;
+	}
+
+	file->initInProgress = true;
+	file->initNext = 0;
+}
+
+/*
+ * Writes a chunk of nblocks initial ORAM pages starting at block firstBlock,
+ * directly through the storage manager.
+ *
+ * Blocks that already exist, such as the metapages created by the database
+ * for the index, are overwritten with smgrwrite and the relation is extended
+ * with smgrextend, skipping the per-block fsync requests. The kernel is
+ * asked to start writing the chunk back right away, so that the disk writes
+ * overlap with the encryption of the next chunk in the enclave.
+ */
+static void
+writeOblivInitChunk(OblivFile *file, const char *pages, BlockNumber firstBlock,
+					unsigned int nblocks, unsigned int blockSize, bool verify)
+{
+	Relation	rel = file->rel;
+	char	   *block;
+	BlockNumber relBlocks;
+	BlockNumber blkno;
+	unsigned int offset;
+
+	if (!file->initInProgress || firstBlock == 0)
+		beginOblivInit(file);
+
+	if (firstBlock != file->initNext)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("Initialization chunk of oblivious file %s starts at block %u instead of block %u",
+						file->name, firstBlock, file->initNext)));
+	}
+
+	if (nblocks > OBLIV_INIT_MAX_CHUNK_BLOCKS)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("Initialization chunk of oblivious file %s has %u blocks, the limit is %d",
+						file->name, nblocks, OBLIV_INIT_MAX_CHUNK_BLOCKS)));
+	}
+
+	/* The storage keeps the file outside of the mirror relation. */
+	if (file->storage->init != NULL)
+	{
+		for (offset = 0; verify && offset < nblocks; offset++)
+		{
+			if (!PageIsVerified((Page) (pages + (offset * BLCKSZ)), firstBlock + offset))
+				elog(ERROR, "Page is not verified when init relation. block %d", firstBlock + offset);
+		}
+
+		file->storage->init(file, pages, firstBlock, nblocks, BLCKSZ);
+		file->initNext = firstBlock + nblocks;
+		return;
+	}
+
+	RelationOpenSmgr(rel);
+	LockRelationForExtension(rel, ExclusiveLock);
+
+	relBlocks = smgrnblocks(rel->rd_smgr, MAIN_FORKNUM);
+	block = (char *) palloc(BLCKSZ);
+
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		blkno = firstBlock + offset;
+
+		if (verify && !PageIsVerified((Page) (pages + (offset * BLCKSZ)), blkno))
+		{
+			elog(ERROR, "Page is not verified when init relation. block %d", blkno);
+		}
+
+		/* The enclave blocks can be smaller than the page. */
+		MemSet(block, 0, BLCKSZ);
+		memcpy(block, pages + (offset * BLCKSZ), blockSize);
+		PageSetChecksumInplace((Page) block, blkno);
+
+		if (blkno < relBlocks)
+			smgrwrite(rel->rd_smgr, MAIN_FORKNUM, blkno, block, true);
+		else
+			smgrextend(rel->rd_smgr, MAIN_FORKNUM, blkno, block, true);
+	}
+
+	UnlockRelationForExtension(rel, ExclusiveLock);
+	pfree(block);
+
+	smgrwriteback(rel->rd_smgr, MAIN_FORKNUM, firstBlock, nblocks);
+
+	file->initNext = firstBlock + nblocks;
+}
+
+/*
+ * Ends the initialization stream of an ORAM file. It is called before the
+ * first block access of the file, as the enclave does not signal the last
+ * chunk.
+ *
+ * The pages were written without going through the WAL or the
+ * checkpointer, so they must reach the disk before the ORAM uses them. Most
+ * of the data is already on disk because of the writeback of each chunk.
+ */
+static void
+finishOblivInit(OblivFile *file)
+{
+	if (!file->initInProgress)
+		return;
+
+	if (file->storage->init != NULL)
+	{
+		file->storage->sync(file);
+	}
+	else
+	{
+		RelationOpenSmgr(file->rel);
+		smgrimmedsync(file->rel->rd_smgr, MAIN_FORKNUM);
+	}
+
+	file->initInProgress = false;
+
+	elog(DEBUG1, "Initialized oblivious file %s with %u blocks", file->name, file->initNext);
+}
+
+/*
+ * Lazy initialization of an ORAM file.
+ *
+ * Instead of writing every initial block, the relation is extended to
+ * nblocks with a single write of its last block, which leaves the rest of
+ * the file sparse. Blocks that already exist are zeroed so that no database
+ * metapage is mistaken for an ORAM block. A block that was never written
+ * reads as an all-zero page, which the enclave treats as an empty bucket.
+ *
+ * The file keeps a bitmap of the blocks written since the allocation, and
+ * the reads of the other blocks are answered with a zero page without any
+ * I/O. The bitmap is not persistent, after a restart every block is read
+ * from storage, where the holes also read as zeros.
+ */
+static void
+allocateOblivFile(OblivFile *file, unsigned int nblocks)
+{
+	Relation	rel = file->rel;
+	char	   *block;
+	BlockNumber relBlocks;
+	BlockNumber blkno;
+
+	beginOblivInit(file);
+
+	if (file->storage->allocate != NULL)
+	{
+		file->storage->allocate(file, nblocks);
+	}
+	else
+	{
+		RelationOpenSmgr(rel);
+		LockRelationForExtension(rel, ExclusiveLock);
+
+		relBlocks = smgrnblocks(rel->rd_smgr, MAIN_FORKNUM);
+		block = (char *) palloc0(BLCKSZ);
+
+		for (blkno = 0; blkno < Min(relBlocks, nblocks); blkno++)
+			smgrwrite(rel->rd_smgr, MAIN_FORKNUM, blkno, block, true);
+
+		if (nblocks > relBlocks)
+			smgrextend(rel->rd_smgr, MAIN_FORKNUM, nblocks - 1, block, true);
+
+		UnlockRelationForExtension(rel, ExclusiveLock);
+		pfree(block);
+	}
+
+	file->lazyWritten = (uint8 *) MemoryContextAllocZero(TopMemoryContext, (nblocks + 7) / 8);
+	file->lazyBlocks = nblocks;
+	file->initNext = nblocks;
 }
 
 /**
@@ -94,94 +726,17 @@ closeOblivStatus()
 * sees fit.  The hash within the enclave works with a virtual index file
 * abstraction that maps the enclave pages to the index relation pages
 * pre-allocated in this procedure.
+*
+* When the index is created by the database, the first blocks of the index
+* (the first four of a hash index, the metapage of a btree) already exist and
+* are overwritten by the soe blocks.
 */
 void
 initIndex(const char *filename, const char *pages, unsigned int nblocks, unsigned int blockSize, int initOffset)
 {
+	OblivFile  *file = &oblivFiles[lookupOblivFile(filename)];
 
-	Relation	rel;
-	int			offset = 0;
-	Buffer		buffer = 0;
-	Page		page = NULL;
-
-
-    //elog(DEBUG1, "Requested to init index  %s for tableName %s and index  name %s", filename, tableName, indexName);
-
-
-	if (status.relIndexMirrorId != InvalidOid)
-	{
-
-		rel = index_open(status.relIndexMirrorId, ExclusiveLock);
-
-		do
-		{
-
-			/**
-	         * when the index is initialized by the database the first four blocks
-	         * of an Hash index already exist and have some defined data.
-	         * we override this blocks
-	         * to be initialized by the soe blocks.
-	         **/
-			if (ihOID == F_HASHHANDLER && (initOffset + offset) < 4)
-			{
-				buffer = ReadBuffer(rel, offset);
-			}
-			else if (ihOID == F_BTHANDLER && (initOffset + offset) == 0)
-			{
-				/**
-		         *  When the btree index is created, block 0 is initiated and
-		         *  has content that must be deleted.
-		         */
-				buffer = ReadBuffer(rel, offset);
-			}
-			else
-			{
-				buffer = ReadBuffer(rel, P_NEW);
-			}
-			/**
-	         * Buffers are not being locked as this extension is not
-	         * considering concurrent accesses to the
-	         * relations. It might raise some unexpected errors if the
-	         * postgres implementation checks if buffers
-	         * have pins or locks associated.
-	         **/
-
-			page = BufferGetPage(buffer);
-
-			memcpy(page, pages + (offset * BLCKSZ), blockSize);
-
-			/*
-			 * We mark all the new buffers dirty, but do nothing to write them
-			 * out; they'll probably get used soon, and even if they are not,
-			 * a crash will leave an okay all-zeroes page on disk.
-			 */
-			MarkBufferDirty(buffer);
-
-			/**
-	         * The original function RelationAdddExtraBlocks updates the
-	         * free space map of the relation but this function does not.
-	         * The free space map is not updated for now and
-	         *  must be considered if it can be used at all since it keeps
-	         * track in plaintext how much
-	         * space is free in each relation block. Only use the fsm if
-	         * it's really necessary for the prototype.
-	         */
-			ReleaseBuffer(buffer);
-
-			offset += 1;
-		} while (offset < nblocks);
-
-		index_close(rel, ExclusiveLock);
-
-	}
-	else
-	{
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_OBJECT),
-				 errmsg("Oblivious table with name %s does not exist in the database",
-						filename)));
-	}
-
+	writeOblivInitChunk(file, pages, initOffset, nblocks, blockSize, false);
 }
 
 /**
@@ -193,75 +748,36 @@ initIndex(const char *filename, const char *pages, unsigned int nblocks, unsigne
  * worry about this. Furthermore, since we know the
  * exact number of blocks the relation must have, we can allocate
  * the space once and never worry about this again.
+ *
+ * Unlike RelationAddExtraBlocks, the blocks are written straight to the
+ * storage manager instead of being dirtied in shared buffers, so the
+ * initialization runs at disk bandwidth and does not leave the checkpointer
+ * with the whole ORAM to write back.
+ *
+ * The original function RelationAdddExtraBlocks updates the
+ * free space map of the relation but this function does not.
+ * The free space map is not updated for now and
+ * must be considered if it can be used at all since it keeps
+ * track in plaintext how much
+ * space is free in each relation block. Only use the fsm if
+ * it's really necessary for the prototype.
  **/
 void
-initRelation(const char *filename, const char *pages, unsigned int nblocks, unsigned int blockSize)
+initRelation(const char *filename, const char *pages, unsigned int nblocks, unsigned int blockSize, int initOffset)
 {
+	OblivFile  *file = &oblivFiles[lookupOblivFile(filename)];
 
-	Relation	rel;
-	Buffer		buffer = 0;
-	int			offset = 0;
-	Page		page = NULL;
-   
-    //elog(DEBUG1, "Initializing heap relation %s with nblocks %d of size %d", filename, nblocks, blockSize);
-   	
-    if (status.relTableMirrorId != InvalidOid)
-	{
-
-		rel = heap_open(status.relTableMirrorId, ExclusiveLock);
-		do
-		{
-			buffer = ReadBuffer(rel, P_NEW);
-
-			/**
-             * Buffers are not being locked as this extension is not
-             * considering concurrent accesses to the
-             * relations. It might raise some unexpected errors if the
-             * postgres implementation checks if buffers
-             * have pins or locks associated.
-             **/
-
-			page = BufferGetPage(buffer);
-            if(!PageIsVerified(pages + (offset * BLCKSZ), BufferGetBlockNumber(buffer))){
-                elog(ERROR, "Page is not verified when init relation. block %d", offset);
-            };
-
-            memcpy(page, (pages + (offset * BLCKSZ)), blockSize);
-
-			/*
-			 * We mark all the new buffers dirty, but do nothing to write them
-			 * out; they'll probably get used soon, and even if they are not,
-			 * a crash will leave an okay all-zeroes page on disk.
-			 */
-			MarkBufferDirty(buffer);
-
-			/**
-             * The original function RelationAdddExtraBlocks updates the
-             * free space map of the relation but this function does not.
-             * The free space map is not updated for now and
-             *  must be considered if it can be used at all since it keeps
-             * track in plaintext how much
-             * space is free in each relation block. Only use the fsm if
-             * it's really necessary for the prototype.
-             */
-			ReleaseBuffer(buffer);
-
-			offset += 1;
-		} while (offset < nblocks);
-		heap_close(rel, ExclusiveLock);
-
-	}
-	else
-	{
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_OBJECT),
-				 errmsg("Oblivious table with name %s does not exist in the database",
-						filename)));
-	}
-
+	writeOblivInitChunk(file, pages, initOffset, nblocks, blockSize, true);
 }
 
 
+/**
+ * The enclave streams the initial image of an ORAM file as a sequence of
+ * chunks of at most OBLIV_INIT_MAX_CHUNK_BLOCKS blocks, initOffset being the
+ * first block of the chunk. The chunks must be sent in order starting at
+ * block 0, so the memory used on both sides of the boundary is bounded by
+ * the chunk size and not by the size of the table.
+ */
 #ifndef UNSAFE
 void
 #else
@@ -269,24 +785,22 @@ sgx_status_t
 #endif
 outFileInit(const char *filename, const char *pages, unsigned int nblocks, unsigned int blocksize, int pageSize, int initOffset)
 {
+	int			fileId;
 
-	if (strcmp(filename, tableName) == 0)
-	{
-		initRelation(filename, pages, nblocks, blocksize);
+	fileId = lookupOblivFile(filename);
+	TRACE_OBLIVPG_FILE_INIT_START(fileId, initOffset, nblocks, blocksize);
 
-	}
-	else if (strcmp(filename, indexName) == 0)
+	if (fileId == OBLIV_HEAP_FILE)
 	{
-		initIndex(filename, pages, nblocks, blocksize, initOffset);
+		initRelation(filename, pages, nblocks, blocksize, initOffset);
 	}
 	else
 	{
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_OBJECT),
-				 errmsg("Enclave requested a file initialization for %s, %s, %s that is not supported",
-						filename, tableName, indexName)));
+		initIndex(filename, pages, nblocks, blocksize, initOffset);
 	}
 
+	TRACE_OBLIVPG_FILE_INIT_DONE(fileId, initOffset, nblocks, blocksize);
+
 #ifdef UNSAFE
 	return SGX_SUCCESS;
 #endif
@@ -294,85 +808,341 @@ outFileInit(const char *filename, const char *pages, unsigned int nblocks, unsig
 
 
 
+/**
+ * Lazy alternative to outFileInit. The enclave only announces the number of
+ * blocks of the file and treats the blocks it reads before writing them as
+ * empty buckets, so the setup cost no longer depends on the table size.
+ */
 #ifndef UNSAFE
 void
 #else
 sgx_status_t
 #endif
-outFileRead(char *page, const char *filename, int blkno, int pageSize)
+outFileAllocate(const char *filename, unsigned int nblocks)
 {
-	Relation	rel;
-	Buffer		buffer;
-	Page		heapPage;
-	bool		isIndex;
-	Oid			targetTable;
+	int			fileId;
+
+	fileId = lookupOblivFile(filename);
+	allocateOblivFile(&oblivFiles[fileId], nblocks);
+
+#ifdef UNSAFE
+	return SGX_SUCCESS;
+#endif
+}
+
+/*
+ * Draws a storage delay in microseconds.
+ */
+static double
+drawInjectDelay(void)
+{
+	double		u;
+
+	switch (oblivInjectDistribution)
+	{
+		case OBLIV_INJECT_UNIFORM:
+			return oblivInjectLatency * 2.0 * ((double) random() / MAX_RANDOM_VALUE);
+		case OBLIV_INJECT_EXPONENTIAL:
+			/* u is in (0, 1] so that the logarithm is finite */
+			u = ((double) random() + 1.0) / ((double) MAX_RANDOM_VALUE + 1.0);
+			return -oblivInjectLatency * log(u);
+		default:
+			return oblivInjectLatency;
+	}
+}
 
-    //elog(DEBUG1, "outFileRead relation %s blocknum %d and size %d", filename, blkno, pageSize);
-	
-    if (strcmp(filename, tableName) == 0)
+/*
+ * Sleeps for the time a slow volume would take to serve nblocks blocks,
+ * when the latency injection is enabled. Used to reproduce network-attached
+ * storage with the ORAM files in the page cache. The delay can be long, so
+ * it is spent waiting on the latch, processing the interrupts, and only the
+ * last millisecond is a plain sleep.
+ */
+static void
+injectStorageDelay(int nblocks, int pageSize)
+{
+	double		delay = 0;
+	int			offset;
+	instr_time	start;
+	instr_time	elapsed;
+	double		remaining;
+	int			rc;
+
+	if (nblocks <= 0 || (oblivInjectLatency == 0 && oblivInjectBandwidth == 0))
+		return;
+
+	if (oblivInjectLatency > 0)
 	{
-		isIndex = false;
-		targetTable = status.relTableMirrorId;
+		for (offset = 0; offset < nblocks; offset += oblivInjectQueueDepth)
+		{
+			double		slowest = 0;
+			int			i;
 
+			for (i = offset; i < Min(offset + oblivInjectQueueDepth, nblocks); i++)
+				slowest = Max(slowest, drawInjectDelay());
+			delay += slowest;
+		}
 	}
-	else if (strcmp(filename, indexName) == 0)
+
+	if (oblivInjectBandwidth > 0)
+		delay += (double) nblocks * pageSize * 1000000.0 / (oblivInjectBandwidth * 1024.0);
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (;;)
 	{
-		isIndex = true;
-		targetTable = status.relIndexMirrorId;
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+		remaining = delay - INSTR_TIME_GET_MICROSEC(elapsed);
+
+		if (remaining < 1000)
+		{
+			if (remaining > 0)
+				pg_usleep((long) remaining);
+			break;
+		}
+
+		rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   (long) (remaining / 1000), PG_WAIT_EXTENSION);
+
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+		if (rc & WL_LATCH_SET)
+			ResetLatch(MyLatch);
+
+		CHECK_FOR_INTERRUPTS();
 	}
-	else
+}
+
+/*
+ * Reads blocks through the storage of the file, except the blocks held by
+ * the treetop cache and the blocks of a lazily allocated file that were
+ * never written, which are returned as zero pages without any I/O.
+ */
+static void
+readOblivBlocks(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize)
+{
+	int		   *ioBlknos;
+	int		   *ioOffsets;
+	char	   *ioPages;
+	int			nio = 0;
+	int			offset;
+
+	if (file->lazyWritten == NULL && file->treetopSlot < 0)
 	{
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_OBJECT),
-				 errmsg("Enclave requested a file read for %s, %s, %s that is not supported",
-						filename, tableName, indexName)));
+		file->storage->readv(file, blknos, nblocks, pages, pageSize);
+		injectStorageDelay(nblocks, pageSize);
+		return;
 	}
 
-	if (targetTable != InvalidOid)
+	ioBlknos = (int *) palloc(sizeof(int) * nblocks);
+	ioOffsets = (int *) palloc(sizeof(int) * nblocks);
+
+	for (offset = 0; offset < nblocks; offset++)
 	{
+		BlockNumber blkno = blknos[offset];
 
-		if (isIndex)
+		if (oblivTreetopRead(file, blkno, pages + (offset * pageSize), pageSize))
 		{
-			rel = index_open(targetTable, RowExclusiveLock);
+			continue;
+		}
+		else if (blkno < file->lazyBlocks && !(file->lazyWritten[blkno / 8] & (1 << (blkno % 8))))
+		{
+			memset(pages + (offset * pageSize), 0, pageSize);
 		}
 		else
 		{
-			rel = heap_open(targetTable, RowExclusiveLock);
+			ioBlknos[nio] = blknos[offset];
+			ioOffsets[nio] = offset;
+			nio++;
 		}
+	}
 
-		/**
-        * Buffers are not being locked as this extension is not
-        * considering concurrent accesses to the
-        * relations. It might raise some unexpected errors if the
-        * postgres implementation checks if buffers
-        * have pins or locks associated.
-        **/
-		buffer = ReadBuffer(rel, blkno);
-		heapPage = BufferGetPage(buffer);
+	if (nio == nblocks)
+	{
+		file->storage->readv(file, blknos, nblocks, pages, pageSize);
+		injectStorageDelay(nblocks, pageSize);
+	}
+	else if (nio > 0)
+	{
+		ioPages = (char *) palloc(nio * pageSize);
+		file->storage->readv(file, ioBlknos, nio, ioPages, pageSize);
+		injectStorageDelay(nio, pageSize);
 
-		memcpy(page, heapPage, pageSize);
+		for (offset = 0; offset < nio; offset++)
+			memcpy(pages + (ioOffsets[offset] * pageSize), ioPages + (offset * pageSize), pageSize);
 
+		pfree(ioPages);
+	}
 
-		ReleaseBuffer(buffer);
+	for (offset = 0; offset < nio; offset++)
+		oblivTreetopFill(file, ioBlknos[offset], pages + (ioOffsets[offset] * pageSize), pageSize);
 
-		if (isIndex)
+	pfree(ioBlknos);
+	pfree(ioOffsets);
+}
+
+static void
+writeOblivBlocks(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize)
+{
+	int		   *ioBlknos;
+	char	   *ioPages;
+	int			nio = 0;
+	int			offset;
+
+	discardOblivState();
+
+	if (file->treetopSlot < 0)
+	{
+		file->storage->writev(file, blknos, nblocks, pages, pageSize);
+		injectStorageDelay(nblocks, pageSize);
+	}
+	else
+	{
+		ioBlknos = (int *) palloc(sizeof(int) * nblocks);
+		ioPages = (char *) palloc(nblocks * pageSize);
+
+		for (offset = 0; offset < nblocks; offset++)
 		{
-			index_close(rel, RowExclusiveLock);
+			if (oblivTreetopWrite(file, blknos[offset], pages + (offset * pageSize), pageSize))
+				continue;
+
+			memcpy(ioPages + (nio * pageSize), pages + (offset * pageSize), pageSize);
+			ioBlknos[nio++] = blknos[offset];
 		}
-		else
+
+		if (nio > 0)
 		{
-			heap_close(rel, RowExclusiveLock);
+			file->storage->writev(file, ioBlknos, nio, ioPages, pageSize);
+			injectStorageDelay(nio, pageSize);
 		}
 
-
+		pfree(ioBlknos);
+		pfree(ioPages);
 	}
-	else
+
+	if (file->lazyWritten == NULL)
+		return;
+
+	for (offset = 0; offset < nblocks; offset++)
 	{
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_OBJECT),
-				 errmsg("Oblivious table with name %s does not exist in the database",
-						filename)));
+		BlockNumber blkno = blknos[offset];
+
+		if (blkno < file->lazyBlocks)
+			file->lazyWritten[blkno / 8] |= (1 << (blkno % 8));
 	}
+}
+
+/*
+ * Copies a block of an ORAM file to the enclave buffer.
+ */
+static void
+readOblivBlock(OblivFile *file, BlockNumber blkno, char *page, int pageSize)
+{
+	Buffer		buffer;
+	Page		heapPage;
+
+	/**
+	 * Buffers are not being locked as this extension is not
+	 * considering concurrent accesses to the
+	 * relations. It might raise some unexpected errors if the
+	 * postgres implementation checks if buffers
+	 * have pins or locks associated.
+	 **/
+	buffer = ReadBuffer(file->rel, blkno);
+	heapPage = BufferGetPage(buffer);
+
+	memcpy(page, heapPage, pageSize);
+
+	ReleaseBuffer(buffer);
+}
+
+/*
+ * Asks the buffer manager to start reading the blocks that are not in
+ * shared buffers, so that the reads of a path are issued together instead
+ * of waiting for each block in turn.
+ */
+static void
+prefetchOblivBlocks(OblivFile *file, const int *blknos, int nblocks)
+{
+	int			offset;
+
+	for (offset = 0; offset < nblocks; offset++)
+		PrefetchBuffer(file->rel, MAIN_FORKNUM, blknos[offset]);
+}
+
+/*
+ * Copies an enclave block to a block of an ORAM file.
+ */
+static void
+writeOblivBlock(OblivFile *file, BlockNumber blkno, const char *page, int pageSize)
+{
+	Buffer		buffer;
+	Page		heapPage;
+
+	buffer = ReadBuffer(file->rel, blkno);
+
+	/**
+	 * Buffers are not being locked as this extension is not
+	 * considering concurrent accesses to the
+	 * relations. It might raise some unexpected errors if the
+	 * postgres implementation checks if buffers
+	 * have pins or locks associated.
+	 **/
+	heapPage = BufferGetPage(buffer);
+
+	memcpy(heapPage, page, pageSize);
+
+	MarkBufferDirty(buffer);
+	ReleaseBuffer(buffer);
+}
+
+
+static void
+bufmgrReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize)
+{
+	int			offset;
+
+	if (nblocks > 1)
+		prefetchOblivBlocks(file, blknos, nblocks);
+
+	for (offset = 0; offset < nblocks; offset++)
+		readOblivBlock(file, blknos[offset], pages + (offset * pageSize), pageSize);
+}
+
+static void
+bufmgrWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize)
+{
+	int			offset;
+
+	for (offset = 0; offset < nblocks; offset++)
+		writeOblivBlock(file, blknos[offset], pages + (offset * pageSize), pageSize);
+}
+
+static void
+bufmgrSync(OblivFile *file)
+{
+	FlushRelationBuffers(file->rel);
+	RelationOpenSmgr(file->rel);
+	smgrimmedsync(file->rel->rd_smgr, MAIN_FORKNUM);
+}
+
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileRead(char *page, int fileId, int blkno, int pageSize)
+{
+	OblivFile  *file;
+	instr_time	start;
+
+	oblivOcallStart(&start, false);
+	TRACE_OBLIVPG_FILE_READ_START(fileId, blkno, pageSize);
+	file = getOblivFile(fileId);
+	oblivCaptureBlocks(fileId, false, &blkno, 1, pageSize);
+	readOblivBlocks(file, &blkno, 1, page, pageSize);
+	TRACE_OBLIVPG_FILE_READ_DONE(fileId, blkno, pageSize);
+	oblivOcallEnd(&start, fileId, file->relId, false, blkno, 1, pageSize);
 
 #ifdef UNSAFE
 	return SGX_SUCCESS;
@@ -385,92 +1155,167 @@ void
 #else
 sgx_status_t
 #endif
-outFileWrite(const char *page, const char *filename, int blkno, int pageSize)
+outFileWrite(const char *page, int fileId, int blkno, int pageSize)
 {
+	OblivFile  *file;
+	instr_time	start;
 
-	Relation	rel;
-	Page		heapPage;
-	Buffer		buffer;
-	bool		isIndex;
-	Oid			targetTable;
-  
-    //elog(DEBUG1, "outFileWrite relation %s blocknum %d and size %d", filename, blkno, pageSize);
+	oblivOcallStart(&start, true);
+	TRACE_OBLIVPG_FILE_WRITE_START(fileId, blkno, pageSize);
+	file = getOblivFile(fileId);
+	oblivCaptureBlocks(fileId, true, &blkno, 1, pageSize);
+	writeOblivBlocks(file, &blkno, 1, page, pageSize);
+	TRACE_OBLIVPG_FILE_WRITE_DONE(fileId, blkno, pageSize);
+	oblivOcallEnd(&start, fileId, file->relId, true, blkno, 1, pageSize);
 
-	buffer = 0;
+#ifdef UNSAFE
+	return SGX_SUCCESS;
+#endif
 
-	if (strcmp(filename, tableName) == 0)
-    {
-	
-		isIndex = false;
-		targetTable = status.relTableMirrorId;
+}
 
-	}
-	else if (strcmp(filename, indexName) == 0)
-	{
-		isIndex = true;
-		targetTable = status.relIndexMirrorId;
-	}
-	else
-	{
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_OBJECT),
-				 errmsg("Enclave requested a outFileWrite for %s that is not supported",
-						filename)));
-	}
+/**
+ * Vectored version of outFileRead. The enclave requests the nblocks blocks
+ * of an ORAM path in a single transition and receives them in the
+ * contiguous pages buffer, block i being stored at offset i * pageSize.
+ */
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileReadv(char *pages, int fileId, const int *blknos, int nblocks, int pageSize)
+{
+	OblivFile  *file;
+	instr_time	start;
+
+	oblivOcallStart(&start, false);
+	TRACE_OBLIVPG_FILE_READV_START(fileId, nblocks, pageSize);
+	file = getOblivFile(fileId);
+	oblivCaptureBlocks(fileId, false, blknos, nblocks, pageSize);
+	readOblivBlocks(file, blknos, nblocks, pages, pageSize);
+	TRACE_OBLIVPG_FILE_READV_DONE(fileId, nblocks, pageSize);
+	oblivOcallEnd(&start, fileId, file->relId, false, nblocks > 0 ? blknos[0] : -1, nblocks,
+				  (int64) nblocks * (pageSize + sizeof(int)));
 
+#ifdef UNSAFE
+	return SGX_SUCCESS;
+#endif
 
-	if (status.relTableMirrorId != InvalidOid)
-	{
+}
 
-		if (isIndex)
-		{
-			rel = index_open(targetTable, RowExclusiveLock);
-		}
-		else
-		{
-			rel = heap_open(targetTable, RowExclusiveLock);
-		}
+/**
+ * Hint from the enclave with the blocks of the next ORAM path it will
+ * access. The reads are started in the background and the later
+ * outFileRead or outFileReadv calls find the blocks already loaded.
+ */
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFilePrefetch(int fileId, const int *blknos, int nblocks)
+{
+	OblivFile  *file;
 
-		buffer = ReadBuffer(rel, blkno);
+	file = getOblivFile(fileId);
+	file->storage->prefetch(file, blknos, nblocks);
 
-		/**
-         * Buffers are not being locked as this extension is not
-         * considering concurrent accesses to the
-         * relations. It might raise some unexpected errors if the
-         * postgres implementation checks if buffers
-         * have pins or locks associated.
-         **/
-		heapPage = BufferGetPage(buffer);
+#ifdef UNSAFE
+	return SGX_SUCCESS;
+#endif
 
-        memcpy(heapPage, page, pageSize);
+}
 
-		MarkBufferDirty(buffer);
-		ReleaseBuffer(buffer);
+/**
+ * Vectored version of outFileWrite used to evict a whole ORAM path in a
+ * single transition. The pages buffer follows the layout of outFileReadv.
+ */
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outFileWritev(const char *pages, int fileId, const int *blknos, int nblocks, int pageSize)
+{
+	OblivFile  *file;
+	instr_time	start;
+
+	oblivOcallStart(&start, true);
+	TRACE_OBLIVPG_FILE_WRITEV_START(fileId, nblocks, pageSize);
+	file = getOblivFile(fileId);
+	oblivCaptureBlocks(fileId, true, blknos, nblocks, pageSize);
+	writeOblivBlocks(file, blknos, nblocks, pages, pageSize);
+	TRACE_OBLIVPG_FILE_WRITEV_DONE(fileId, nblocks, pageSize);
+	oblivOcallEnd(&start, fileId, file->relId, true, nblocks > 0 ? blknos[0] : -1, nblocks,
+				  (int64) nblocks * (pageSize + sizeof(int)));
 
-		if (isIndex)
-		{
-			index_close(rel, RowExclusiveLock);
-		}
-		else
-		{
-			heap_close(rel, RowExclusiveLock);
-		}
+#ifdef UNSAFE
+	return SGX_SUCCESS;
+#endif
+
+}
 
-	}
-	else
-	{
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_OBJECT),
-				 errmsg("Oblivious table with name %s does not exist in the database",
-						filename)));
-	}
 
+/**
+ * Empty ocall issued by the calibrate ecall to measure the cost of an
+ * ocall transition.
+ */
+#ifndef UNSAFE
+void
+#else
+sgx_status_t
+#endif
+outCalibrate(void)
+{
 #ifdef UNSAFE
 	return SGX_SUCCESS;
 #endif
-
 }
 
+/*
+ * Times loops reads of random blocks of an ORAM file of nblocks blocks,
+ * for obliv_calibrate, and returns the microseconds per block. The blocks
+ * of the treetop cache are skipped and the reads go straight to the
+ * storage backend, so they are not captured, traced, counted, delayed or
+ * answered by a lazy allocation.
+ */
+double
+calibrateOblivStorage(int fileId, BlockNumber nblocks, int loops)
+{
+	OblivFile  *file = getOblivFile(fileId);
+	BlockNumber firstBlock = 0;
+	instr_time	start;
+	instr_time	duration;
+	char	   *page;
+	int			blkno;
+	int			i;
+
+	if (file->treetopSlot >= 0)
+		firstBlock = ((BlockNumber) 1 << oblivTreetopLevels) - 1;
+
+	if (nblocks <= firstBlock)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("every block of oblivious file %s is in the treetop cache", file->name)));
+	}
+
+	page = (char *) palloc(BLCKSZ);
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (i = 0; i < loops; i++)
+	{
+		blkno = firstBlock + random() % (nblocks - firstBlock);
+		file->storage->readv(file, &blkno, 1, page, BLCKSZ);
+	}
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+
+	pfree(page);
+
+	return INSTR_TIME_GET_MICROSEC(duration) / loops;
+}
 
 #ifndef UNSAFE
 void
@@ -0,0 +1,628 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_remote.c
+ *	  remote storage backend for the ORAM files
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_remote.c
+ *
+ * The ORAM files are stored by a block server, tools/obliv_blockserver,
+ * reached at oblivpg_fdw.remote_address over TCP or a Unix socket, as in
+ * the ORAM deployments that keep the buckets on an untrusted storage
+ * server. The mirror relations stay empty: the initial image of the files,
+ * the lazy allocations and every block access go to the server, with the
+ * protocol of include/obliv_remote_proto.h.
+ *
+ * Each backend keeps one connection to the server. The blocks of a path
+ * are sent in a single frame. Writes and prefetches are pipelined: they
+ * are sent without waiting for their response, and up to
+ * oblivpg_fdw.remote_pipeline_depth of them can be in flight. The server
+ * answers in order, so the responses of the pending requests are read
+ * before the response of the next read, and a failed write is reported by
+ * the next call that reads a response.
+ *
+ * The socket is non-blocking and the backend waits for it on its latch, so
+ * a query can be canceled while the server is slow or unreachable, and
+ * oblivpg_fdw.remote_timeout bounds every wait. An interrupted frame leaves
+ * the stream in an unknown state, so the connection is dropped and the next
+ * access opens a new one.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "include/obliv_remote_proto.h"
+#include "include/obliv_storage.h"
+
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+typedef struct RemoteFile
+{
+	RelFileNode node;			/* relation of the ORAM file */
+	int			handle;			/* handle returned by the server */
+} RemoteFile;
+
+char	   *oblivRemoteAddress = NULL;
+int			oblivRemotePipelineDepth = 16;
+int			oblivRemoteTimeout = 0;
+
+static pgsocket remoteSock = PGINVALID_SOCKET;
+static uint32 remoteNextId = 0;
+static int	remotePending = 0;	/* requests sent without their response read */
+static RemoteFile remoteFiles[OBLIV_REMOTE_MAX_HANDLES];
+static int	remoteNFiles = 0;
+
+static void remoteConnect(void);
+static void remoteDisconnect(void);
+static void remoteWait(int event);
+static void remoteSend(struct iovec *iov, int iovcnt);
+static void remoteRecv(void *buf, size_t len);
+static uint32 remoteRequest(int type, int handle, int nblocks, int blockSize,
+							const char *payload, size_t length,
+							const int *blknos, const char *pages);
+static OblivRemoteResponse remoteResponse(uint32 id, char *pages, size_t length);
+static void remoteDrain(int maxPending);
+static int	remoteHandle(OblivFile *file);
+static void remoteAttach(OblivFile *file);
+static void remoteDetach(OblivFile *file);
+static void remoteReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize);
+static void remoteWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize);
+static void remotePrefetch(OblivFile *file, const int *blknos, int nblocks);
+static void remoteSync(OblivFile *file);
+static void remoteInit(OblivFile *file, const char *pages, BlockNumber firstBlock, int nblocks, int pageSize);
+static void remoteAllocate(OblivFile *file, BlockNumber nblocks);
+
+const OblivStorageRoutine oblivRemoteStorage = {
+	"remote",
+	remoteAttach,
+	remoteDetach,
+	remoteReadv,
+	remoteWritev,
+	remotePrefetch,
+	remoteSync,
+	remoteInit,
+	remoteAllocate
+};
+
+/*
+ * Connects to the block server and checks the protocol version.
+ */
+static void
+remoteConnect(void)
+{
+	uint32		id;
+	int			one = 1;
+
+	if (remoteSock != PGINVALID_SOCKET)
+		return;
+
+	if (oblivRemoteAddress == NULL || oblivRemoteAddress[0] == '\0')
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("oblivpg_fdw.remote_address must be set to use the remote storage")));
+	}
+
+	if (oblivRemoteAddress[0] == '/')
+	{
+		struct sockaddr_un addr;
+
+		if (strlen(oblivRemoteAddress) >= sizeof(addr.sun_path))
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("Unix socket path \"%s\" is too long", oblivRemoteAddress)));
+		}
+
+		MemSet(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, oblivRemoteAddress);
+
+		remoteSock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (remoteSock != PGINVALID_SOCKET &&
+			connect(remoteSock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+		{
+			closesocket(remoteSock);
+			remoteSock = PGINVALID_SOCKET;
+		}
+	}
+	else
+	{
+		struct addrinfo hints;
+		struct addrinfo *res;
+		struct addrinfo *addr;
+		char	   *host = pstrdup(oblivRemoteAddress);
+		char	   *port = strrchr(host, ':');
+		int			rc;
+
+		if (port == NULL)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid block server address \"%s\"", oblivRemoteAddress),
+					 errhint("The address is host:port or the path of a Unix socket.")));
+		}
+		*port++ = '\0';
+
+		MemSet(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		rc = getaddrinfo(host, port, &hints, &res);
+		if (rc != 0)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_CONNECTION_FAILURE),
+					 errmsg("could not resolve block server address \"%s\": %s",
+							oblivRemoteAddress, gai_strerror(rc))));
+		}
+
+		for (addr = res; addr != NULL; addr = addr->ai_next)
+		{
+			remoteSock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+			if (remoteSock == PGINVALID_SOCKET)
+				continue;
+			if (connect(remoteSock, addr->ai_addr, addr->ai_addrlen) == 0)
+				break;
+			closesocket(remoteSock);
+			remoteSock = PGINVALID_SOCKET;
+		}
+
+		freeaddrinfo(res);
+		pfree(host);
+
+		if (remoteSock != PGINVALID_SOCKET)
+			(void) setsockopt(remoteSock, IPPROTO_TCP, TCP_NODELAY, (char *) &one, sizeof(one));
+	}
+
+	if (remoteSock == PGINVALID_SOCKET)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_CONNECTION_FAILURE),
+				 errmsg("could not connect to block server \"%s\": %m", oblivRemoteAddress)));
+	}
+
+	if (!pg_set_noblock(remoteSock))
+	{
+		int			save_errno = errno;
+
+		remoteDisconnect();
+		errno = save_errno;
+		ereport(ERROR,
+				(errcode(ERRCODE_CONNECTION_FAILURE),
+				 errmsg("could not set block server socket to nonblocking mode: %m")));
+	}
+
+	remoteNextId = 0;
+	remotePending = 0;
+	remoteNFiles = 0;
+
+	id = remoteRequest(OBLIV_REMOTE_HELLO, 0, OBLIV_REMOTE_VERSION, 0, NULL, 0, NULL, NULL);
+	remoteResponse(id, NULL, 0);
+
+	elog(DEBUG1, "Connected to block server %s", oblivRemoteAddress);
+}
+
+static void
+remoteDisconnect(void)
+{
+	if (remoteSock == PGINVALID_SOCKET)
+		return;
+
+	closesocket(remoteSock);
+	remoteSock = PGINVALID_SOCKET;
+	remotePending = 0;
+	remoteNFiles = 0;
+}
+
+/*
+ * Waits until the socket is ready for event, processing the interrupts.
+ * The connection is closed before an interrupt or the timeout aborts the
+ * frame being transferred.
+ */
+static void
+remoteWait(int event)
+{
+	int			rc;
+
+	rc = WaitLatchOrSocket(MyLatch,
+						   WL_LATCH_SET | WL_POSTMASTER_DEATH | event |
+						   (oblivRemoteTimeout > 0 ? WL_TIMEOUT : 0),
+						   remoteSock, oblivRemoteTimeout, PG_WAIT_EXTENSION);
+
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+
+	if (rc & WL_LATCH_SET)
+	{
+		ResetLatch(MyLatch);
+
+		PG_TRY();
+		{
+			CHECK_FOR_INTERRUPTS();
+		}
+		PG_CATCH();
+		{
+			remoteDisconnect();
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+	}
+
+	if (rc & WL_TIMEOUT)
+	{
+		remoteDisconnect();
+		ereport(ERROR,
+				(errcode(ERRCODE_CONNECTION_FAILURE),
+				 errmsg("timed out waiting for block server \"%s\"", oblivRemoteAddress)));
+	}
+}
+
+/*
+ * Sends a whole frame. The connection is closed on failure, as the stream
+ * can no longer be parsed by the server.
+ */
+static void
+remoteSend(struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0)
+	{
+		ssize_t		n = writev(remoteSock, iov, iovcnt);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			remoteWait(WL_SOCKET_WRITEABLE);
+			continue;
+		}
+		if (n < 0)
+		{
+			int			save_errno = errno;
+
+			remoteDisconnect();
+			errno = save_errno;
+			ereport(ERROR,
+					(errcode(ERRCODE_CONNECTION_FAILURE),
+					 errmsg("could not send to block server \"%s\": %m", oblivRemoteAddress)));
+		}
+
+		while (iovcnt > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+static void
+remoteRecv(void *buf, size_t len)
+{
+	char	   *ptr = (char *) buf;
+
+	while (len > 0)
+	{
+		ssize_t		n = recv(remoteSock, ptr, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			remoteWait(WL_SOCKET_READABLE);
+			continue;
+		}
+		if (n <= 0)
+		{
+			int			save_errno = errno;
+
+			remoteDisconnect();
+			errno = save_errno;
+			if (n == 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_CONNECTION_FAILURE),
+						 errmsg("block server \"%s\" closed the connection", oblivRemoteAddress)));
+			ereport(ERROR,
+					(errcode(ERRCODE_CONNECTION_FAILURE),
+					 errmsg("could not receive from block server \"%s\": %m", oblivRemoteAddress)));
+		}
+		ptr += n;
+		len -= n;
+	}
+}
+
+/*
+ * Sends a request without waiting for its response and returns its id.
+ * The payload is either the given bytes, or the block numbers followed by
+ * the pages of a write.
+ */
+static uint32
+remoteRequest(int type, int handle, int nblocks, int blockSize,
+			  const char *payload, size_t length,
+			  const int *blknos, const char *pages)
+{
+	OblivRemoteRequest req;
+	struct iovec iov[3];
+	uint32	   *netBlknos = NULL;
+	int			iovcnt = 1;
+	int			offset;
+
+	if (blknos != NULL)
+	{
+		netBlknos = (uint32 *) palloc(sizeof(uint32) * nblocks);
+		for (offset = 0; offset < nblocks; offset++)
+			netBlknos[offset] = htonl((uint32) blknos[offset]);
+
+		iov[iovcnt].iov_base = netBlknos;
+		iov[iovcnt].iov_len = sizeof(uint32) * nblocks;
+		iovcnt++;
+		length = sizeof(uint32) * nblocks;
+
+		if (pages != NULL)
+		{
+			iov[iovcnt].iov_base = (void *) pages;
+			iov[iovcnt].iov_len = (size_t) nblocks * blockSize;
+			iovcnt++;
+			length += (size_t) nblocks * blockSize;
+		}
+	}
+	else if (length > 0)
+	{
+		iov[iovcnt].iov_base = (void *) payload;
+		iov[iovcnt].iov_len = length;
+		iovcnt++;
+	}
+
+	req.length = htonl((uint32) length);
+	req.id = htonl(remoteNextId);
+	req.type = (uint8) type;
+	req.handle = (uint8) handle;
+	req.reserved = 0;
+	req.nblocks = htonl((uint32) nblocks);
+	req.blockSize = htonl((uint32) blockSize);
+
+	iov[0].iov_base = &req;
+	iov[0].iov_len = sizeof(req);
+
+	remoteSend(iov, iovcnt);
+
+	if (netBlknos != NULL)
+		pfree(netBlknos);
+
+	remotePending++;
+	return remoteNextId++;
+}
+
+/*
+ * Reads the response of request id, which must be the oldest pending
+ * request, and copies its payload of length bytes to pages.
+ */
+static OblivRemoteResponse
+remoteResponse(uint32 id, char *pages, size_t length)
+{
+	OblivRemoteResponse resp;
+
+	remoteRecv(&resp, sizeof(resp));
+	resp.length = ntohl(resp.length);
+	resp.id = ntohl(resp.id);
+	resp.handle = ntohs(resp.handle);
+	resp.nblocks = ntohl(resp.nblocks);
+	remotePending--;
+
+	if (resp.id != id)
+	{
+		remoteDisconnect();
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("block server answered request %u instead of request %u", resp.id, id)));
+	}
+
+	if (resp.status != OBLIV_REMOTE_OK)
+	{
+		char	   *message = (char *) palloc(resp.length + 1);
+
+		remoteRecv(message, resp.length);
+		message[resp.length] = '\0';
+
+		/*
+		 * The responses of the other pipelined requests are dropped with the
+		 * connection, the next access opens a new one.
+		 */
+		remoteDisconnect();
+		ereport(ERROR,
+				(errcode(ERRCODE_IO_ERROR),
+				 errmsg("block server \"%s\" failed: %s", oblivRemoteAddress, message)));
+	}
+
+	if (resp.length != length)
+	{
+		remoteDisconnect();
+		ereport(ERROR,
+				(errcode(ERRCODE_PROTOCOL_VIOLATION),
+				 errmsg("block server returned %u bytes instead of %lu",
+						resp.length, (unsigned long) length)));
+	}
+
+	if (length > 0)
+		remoteRecv(pages, length);
+
+	return resp;
+}
+
+/*
+ * Reads the responses of the pipelined requests until at most maxPending
+ * are left.
+ */
+static void
+remoteDrain(int maxPending)
+{
+	while (remotePending > maxPending)
+		remoteResponse(remoteNextId - remotePending, NULL, 0);
+}
+
+/*
+ * Returns the server handle of the file, opening it on the first use by
+ * the connection. The server file is named after the relfilenode of the
+ * mirror relation.
+ */
+static int
+remoteHandle(OblivFile *file)
+{
+	OblivRemoteResponse resp;
+	char		name[OBLIV_REMOTE_MAX_NAME + 1];
+	uint32		id;
+	int			i;
+
+	remoteConnect();
+
+	for (i = 0; i < remoteNFiles; i++)
+	{
+		if (RelFileNodeEquals(remoteFiles[i].node, file->rel->rd_node))
+			return remoteFiles[i].handle;
+	}
+
+	if (remoteNFiles == OBLIV_REMOTE_MAX_HANDLES)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many oblivious files open on block server \"%s\"", oblivRemoteAddress)));
+	}
+
+	snprintf(name, sizeof(name), "%u_%u_%u", file->rel->rd_node.spcNode,
+			 file->rel->rd_node.dbNode, file->rel->rd_node.relNode);
+
+	remoteDrain(0);
+	id = remoteRequest(OBLIV_REMOTE_OPEN, 0, 0, 0, name, strlen(name), NULL, NULL);
+	resp = remoteResponse(id, NULL, 0);
+
+	remoteFiles[remoteNFiles].node = file->rel->rd_node;
+	remoteFiles[remoteNFiles].handle = resp.handle;
+	remoteNFiles++;
+
+	elog(DEBUG1, "Oblivious file %s is stored as %s on block server %s",
+		 file->name, name, oblivRemoteAddress);
+
+	return resp.handle;
+}
+
+static void
+remoteAttach(OblivFile *file)
+{
+	(void) remoteHandle(file);
+}
+
+static void
+remoteDetach(OblivFile *file)
+{
+	if (remoteSock != PGINVALID_SOCKET)
+		remoteSync(file);
+}
+
+static void
+remoteReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize)
+{
+	int			handle = remoteHandle(file);
+	uint32		firstId = remoteNextId;
+	int			nframes = 0;
+	int			offset;
+
+	/* Every frame of the request is sent before reading the responses. */
+	for (offset = 0; offset < nblocks; offset += OBLIV_REMOTE_MAX_BLOCKS)
+	{
+		remoteRequest(OBLIV_REMOTE_READ, handle, Min(nblocks - offset, OBLIV_REMOTE_MAX_BLOCKS),
+					  pageSize, NULL, 0, blknos + offset, NULL);
+		nframes++;
+	}
+
+	remoteDrain(nframes);
+
+	for (offset = 0; offset < nblocks; offset += OBLIV_REMOTE_MAX_BLOCKS)
+	{
+		int			n = Min(nblocks - offset, OBLIV_REMOTE_MAX_BLOCKS);
+
+		remoteResponse(firstId++, pages + ((size_t) offset * pageSize), (size_t) n * pageSize);
+	}
+}
+
+static void
+remoteWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize)
+{
+	int			handle = remoteHandle(file);
+	int			offset;
+
+	for (offset = 0; offset < nblocks; offset += OBLIV_REMOTE_MAX_BLOCKS)
+	{
+		remoteDrain(oblivRemotePipelineDepth - 1);
+		remoteRequest(OBLIV_REMOTE_WRITE, handle, Min(nblocks - offset, OBLIV_REMOTE_MAX_BLOCKS),
+					  pageSize, NULL, 0, blknos + offset, pages + ((size_t) offset * pageSize));
+	}
+}
+
+static void
+remotePrefetch(OblivFile *file, const int *blknos, int nblocks)
+{
+	int			handle = remoteHandle(file);
+
+	remoteDrain(oblivRemotePipelineDepth - 1);
+	remoteRequest(OBLIV_REMOTE_PREFETCH, handle, Min(nblocks, OBLIV_REMOTE_MAX_BLOCKS),
+				  BLCKSZ, NULL, 0, blknos, NULL);
+}
+
+static void
+remoteSync(OblivFile *file)
+{
+	int			handle = remoteHandle(file);
+
+	remoteRequest(OBLIV_REMOTE_SYNC, handle, 0, 0, NULL, 0, NULL, NULL);
+	remoteDrain(0);
+}
+
+/*
+ * Sends a chunk of the initial image of the file. The chunks are pipelined
+ * like the writes and the file is synced by finishOblivInit.
+ */
+static void
+remoteInit(OblivFile *file, const char *pages, BlockNumber firstBlock, int nblocks, int pageSize)
+{
+	int		   *blknos = (int *) palloc(sizeof(int) * nblocks);
+	int			offset;
+
+	for (offset = 0; offset < nblocks; offset++)
+		blknos[offset] = firstBlock + offset;
+
+	remoteWritev(file, blknos, nblocks, pages, pageSize);
+
+	pfree(blknos);
+}
+
+static void
+remoteAllocate(OblivFile *file, BlockNumber nblocks)
+{
+	int			handle = remoteHandle(file);
+
+	remoteRequest(OBLIV_REMOTE_ALLOCATE, handle, nblocks, BLCKSZ, NULL, 0, NULL, NULL);
+	remoteDrain(0);
+}
@@ -0,0 +1,422 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_stats.c
+ *	  cumulative statistics of the oblivious tables in shared memory
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_stats.c
+ *
+ * Every foreign table has an entry with the number of lookups and inserts,
+ * the ecalls and block ocalls issued for them, the blocks and bytes they
+ * moved and a log2 histogram of the latency of each ecall and ocall type.
+ * The statistics are shown by the pg_stat_oblivious view and cleared by
+ * obliv_stat_reset().
+ *
+ * The ocalls of an ecall are counted in a backend-local area and added to
+ * the entry of the table when the ecall returns, so a transition takes the
+ * entry lock once. The area is only available when the library is in
+ * shared_preload_libraries.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "include/obliv_stats.h"
+
+#include <math.h>
+
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/tuplestore.h"
+
+#define OBLIV_STATS_TRANCHE "oblivpg_fdw stats"
+
+#define OBLIV_STATS_COLS 21
+
+typedef struct OblivStatsCounters
+{
+	int64		lookups;
+	int64		inserts;
+	int64		ecalls;
+	int64		ocallReads;
+	int64		ocallWrites;
+	int64		blocksRead;
+	int64		blocksWritten;
+	int64		bytes;			/* bytes copied across the enclave boundary */
+	int64		hist[OBLIV_STAT_NOPS][OBLIV_STAT_BUCKETS];
+} OblivStatsCounters;
+
+typedef struct OblivStatsEntry
+{
+	Oid			ftwOid;			/* hash key, must be first */
+	slock_t		mutex;			/* protects the counters */
+	OblivStatsCounters counters;
+} OblivStatsEntry;
+
+typedef struct OblivStatsShared
+{
+	LWLock	   *lock;			/* protects the hash table */
+} OblivStatsShared;
+
+static OblivStatsShared *oblivStats = NULL;
+static HTAB *oblivStatsHash = NULL;
+
+/* Counters of the current ecall, added to the entry of pendingTable */
+static OblivStatsCounters pending;
+static Oid	pendingTable = InvalidOid;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static Size statsShmemSize(void);
+static void statsShmemStartup(void);
+static int	latencyBucket(double usec);
+static Datum histPercentile(const int64 *hist, double q, bool *isnull);
+
+PG_FUNCTION_INFO_V1(obliv_stat_tables);
+PG_FUNCTION_INFO_V1(obliv_stat_reset);
+
+static Size
+statsShmemSize(void)
+{
+	return add_size(MAXALIGN(sizeof(OblivStatsShared)),
+					hash_estimate_size(OBLIV_STATS_MAX_TABLES, sizeof(OblivStatsEntry)));
+}
+
+/*
+ * Requests the shared memory of the statistics. Called by _PG_init.
+ */
+void
+oblivStatsRequest(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	RequestAddinShmemSpace(statsShmemSize());
+	RequestNamedLWLockTranche(OBLIV_STATS_TRANCHE, 1);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = statsShmemStartup;
+}
+
+static void
+statsShmemStartup(void)
+{
+	HASHCTL		info;
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	oblivStats = ShmemInitStruct("oblivpg_fdw stats", sizeof(OblivStatsShared), &found);
+	if (!found)
+		oblivStats->lock = &(GetNamedLWLockTranche(OBLIV_STATS_TRANCHE))->lock;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(Oid);
+	info.entrysize = sizeof(OblivStatsEntry);
+	oblivStatsHash = ShmemInitHash("oblivpg_fdw stats hash",
+								   OBLIV_STATS_MAX_TABLES, OBLIV_STATS_MAX_TABLES,
+								   &info, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+bool
+oblivStatsEnabled(void)
+{
+	return oblivStats != NULL;
+}
+
+static int
+latencyBucket(double usec)
+{
+	int			bucket = 0;
+	uint64		value = usec < 1 ? 1 : (uint64) usec;
+
+	while (value >= 2 && bucket < OBLIV_STAT_BUCKETS - 1)
+	{
+		value >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/*
+ * Starts counting the ocalls of an ecall on a foreign table. The ocalls
+ * issued outside of the ecalls, such as the initialization of the files,
+ * are not counted.
+ */
+void
+oblivStatsBeginEcall(Oid ftwOid)
+{
+	if (oblivStats == NULL)
+		return;
+
+	memset(&pending, 0, sizeof(pending));
+	pendingTable = ftwOid;
+}
+
+/*
+ * Adds the ecall and its ocalls to the entry of the table.
+ */
+void
+oblivStatsEndEcall(int op, double usec, int64 bytes)
+{
+	OblivStatsEntry *entry;
+	bool		found;
+	int			i;
+	int			b;
+
+	if (oblivStats == NULL || pendingTable == InvalidOid)
+		return;
+
+	pending.ecalls++;
+	pending.bytes += bytes;
+	pending.hist[op][latencyBucket(usec)]++;
+
+	LWLockAcquire(oblivStats->lock, LW_SHARED);
+
+	entry = (OblivStatsEntry *) hash_search(oblivStatsHash, &pendingTable, HASH_FIND, NULL);
+	if (entry == NULL)
+	{
+		LWLockRelease(oblivStats->lock);
+		LWLockAcquire(oblivStats->lock, LW_EXCLUSIVE);
+
+		entry = (OblivStatsEntry *) hash_search(oblivStatsHash, &pendingTable, HASH_ENTER_NULL, &found);
+		if (entry != NULL && !found)
+		{
+			SpinLockInit(&entry->mutex);
+			memset(&entry->counters, 0, sizeof(OblivStatsCounters));
+		}
+	}
+
+	if (entry != NULL)
+	{
+		SpinLockAcquire(&entry->mutex);
+		entry->counters.lookups += pending.lookups;
+		entry->counters.inserts += pending.inserts;
+		entry->counters.ecalls += pending.ecalls;
+		entry->counters.ocallReads += pending.ocallReads;
+		entry->counters.ocallWrites += pending.ocallWrites;
+		entry->counters.blocksRead += pending.blocksRead;
+		entry->counters.blocksWritten += pending.blocksWritten;
+		entry->counters.bytes += pending.bytes;
+		for (i = 0; i < OBLIV_STAT_NOPS; i++)
+			for (b = 0; b < OBLIV_STAT_BUCKETS; b++)
+				entry->counters.hist[i][b] += pending.hist[i][b];
+		SpinLockRelease(&entry->mutex);
+	}
+	else
+		elog(DEBUG1, "No oblivious statistics entry left for table %u", pendingTable);
+
+	LWLockRelease(oblivStats->lock);
+
+	pendingTable = InvalidOid;
+}
+
+/*
+ * Counts a block ocall of the current ecall.
+ */
+void
+oblivStatsOcall(int op, int nblocks, int64 bytes, double usec)
+{
+	if (pendingTable == InvalidOid)
+		return;
+
+	if (op == OBLIV_STAT_OCALL_WRITE)
+	{
+		pending.ocallWrites++;
+		pending.blocksWritten += nblocks;
+	}
+	else
+	{
+		pending.ocallReads++;
+		pending.blocksRead += nblocks;
+	}
+
+	pending.bytes += bytes;
+	pending.hist[op][latencyBucket(usec)]++;
+}
+
+/*
+ * Counts the keys looked up by the current ecall.
+ */
+void
+oblivStatsLookup(int nkeys)
+{
+	if (pendingTable != InvalidOid)
+		pending.lookups += nkeys;
+}
+
+void
+oblivStatsInsert(void)
+{
+	if (pendingTable != InvalidOid)
+		pending.inserts++;
+}
+
+/*
+ * Upper bound, in microseconds, of the bucket that holds the q quantile of
+ * a histogram. NULL if the histogram is empty.
+ */
+static Datum
+histPercentile(const int64 *hist, double q, bool *isnull)
+{
+	int64		total = 0;
+	int64		target;
+	int64		cumulative = 0;
+	int			b;
+
+	for (b = 0; b < OBLIV_STAT_BUCKETS; b++)
+		total += hist[b];
+
+	*isnull = total == 0;
+	if (total == 0)
+		return (Datum) 0;
+
+	target = (int64) ceil(q * total);
+
+	for (b = 0; b < OBLIV_STAT_BUCKETS - 1; b++)
+	{
+		cumulative += hist[b];
+		if (cumulative >= target)
+			break;
+	}
+
+	return Float8GetDatum(ldexp(1.0, b + 1));
+}
+
+/*
+ * Returns the statistics of every foreign table, one row per table.
+ */
+Datum
+obliv_stat_tables(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext per_query_ctx;
+	MemoryContext oldcontext;
+	HASH_SEQ_STATUS status;
+	OblivStatsEntry *entry;
+	static const double quantiles[] = {0.5, 0.99, 0.999};
+
+	if (oblivStats == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("oblivpg_fdw must be loaded via shared_preload_libraries")));
+	}
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+	oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+	tupstore = tuplestore_begin_heap(true, false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	LWLockAcquire(oblivStats->lock, LW_SHARED);
+
+	hash_seq_init(&status, oblivStatsHash);
+	while ((entry = (OblivStatsEntry *) hash_seq_search(&status)) != NULL)
+	{
+		Datum		values[OBLIV_STATS_COLS];
+		bool		nulls[OBLIV_STATS_COLS];
+		OblivStatsCounters counters;
+		int			i = 0;
+		int			op;
+		int			q;
+
+		SpinLockAcquire(&entry->mutex);
+		counters = entry->counters;
+		SpinLockRelease(&entry->mutex);
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[i++] = ObjectIdGetDatum(entry->ftwOid);
+		values[i++] = Int64GetDatum(counters.lookups);
+		values[i++] = Int64GetDatum(counters.inserts);
+		values[i++] = Int64GetDatum(counters.ecalls);
+		values[i++] = Int64GetDatum(counters.ocallReads);
+		values[i++] = Int64GetDatum(counters.ocallWrites);
+		values[i++] = Int64GetDatum(counters.blocksRead);
+		values[i++] = Int64GetDatum(counters.blocksWritten);
+		values[i++] = Int64GetDatum(counters.bytes);
+
+		for (op = 0; op < OBLIV_STAT_NOPS; op++)
+		{
+			for (q = 0; q < lengthof(quantiles); q++)
+			{
+				values[i] = histPercentile(counters.hist[op], quantiles[q], &nulls[i]);
+				i++;
+			}
+		}
+
+		Assert(i == OBLIV_STATS_COLS);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	LWLockRelease(oblivStats->lock);
+
+	tuplestore_donestoring(tupstore);
+
+	return (Datum) 0;
+}
+
+/*
+ * Removes the statistics of every foreign table.
+ */
+Datum
+obliv_stat_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS status;
+	OblivStatsEntry *entry;
+
+	if (oblivStats == NULL)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("oblivpg_fdw must be loaded via shared_preload_libraries")));
+	}
+
+	LWLockAcquire(oblivStats->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, oblivStatsHash);
+	while ((entry = (OblivStatsEntry *) hash_seq_search(&status)) != NULL)
+		hash_search(oblivStatsHash, &entry->ftwOid, HASH_REMOVE, NULL);
+
+	LWLockRelease(oblivStats->lock);
+
+	PG_RETURN_VOID();
+}
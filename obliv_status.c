@@ -12,6 +12,13 @@
  *
  * INTERFACE ROUTINES
  *		getIndexStatus()			- Obtain information on a given oblivious table.
+ *		lookupOblivTable()			- Cached information on a given oblivious table.
+ *
+ * The cache of lookupOblivTable is a backend-local hash table keyed by the
+ * foreign table oid. Its entries are removed by a relcache callback when the
+ * mapping table or the mirror relations of a table are invalidated. The
+ * changes to the rows of the mapping table invalidate its relcache entry
+ * through the obliv_mapping_invalidate trigger.
  *
  *-------------------------------------------------------------------------
  */
@@ -30,6 +37,18 @@
 #include "utils/rel.h"
 #include "utils/snapmgr.h"
 #include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "access/genam.h"
+#include "access/nbtree.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_namespace_d.h"
+
+static HTAB *oblivTableCache = NULL;
+static Oid	oblivMappingOid = InvalidOid;
+
+static void oblivTableCacheCallback(Datum arg, Oid relid);
 
 FdwOblivTableStatus
 getOblivTableStatus(Oid ftwOid, Relation rel)
@@ -242,6 +261,9 @@ setOblivStatusInitated(FdwOblivTableStatus status, Relation mappingRel)
 		simple_heap_update(mappingRel, &oldTuple->t_self, newTuple);
 		/* heap_freetuple(newTuple); */
 
+		/* The update does not fire the trigger of the mapping table. */
+		CacheInvalidateRelcache(mappingRel);
+
 	}
 	else
 	{
@@ -262,3 +284,123 @@ setOblivStatusInitated(FdwOblivTableStatus status, Relation mappingRel)
 }
 
 
+
+/*
+ * Drops the cached tables when the mapping table, a foreign table or one of
+ * its mirror relations is invalidated. relid is InvalidOid when the whole
+ * relcache is reset.
+ */
+static void
+oblivTableCacheCallback(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	OblivTableCacheEntry *entry;
+	bool		all;
+
+	all = relid == InvalidOid || relid == oblivMappingOid;
+	if (all)
+		oblivMappingOid = InvalidOid;
+
+	if (oblivTableCache == NULL)
+		return;
+
+	hash_seq_init(&status, oblivTableCache);
+	while ((entry = (OblivTableCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (all || entry->ftwOid == relid ||
+			entry->status.relTableMirrorId == relid ||
+			entry->status.relIndexMirrorId == relid)
+			hash_search(oblivTableCache, &entry->ftwOid, HASH_REMOVE, NULL);
+	}
+}
+
+/*
+ * Oid of the mapping table, InvalidOid if it does not exist.
+ */
+Oid
+getOblivMappingOid(void)
+{
+	if (oblivMappingOid == InvalidOid)
+		oblivMappingOid = get_relname_relid(OBLIV_MAPPING_TABLE_NAME, PG_PUBLIC_NAMESPACE);
+
+	return oblivMappingOid;
+}
+
+/*
+ * Copies the cached information of an oblivious table into entry, reading
+ * the mapping table and the mirror index on a cache miss. Returns false if
+ * the mapping table does not exist.
+ *
+ * The information is copied out because any lock acquisition can process
+ * invalidations and remove the cache entries.
+ */
+bool
+lookupOblivTable(Oid ftwOid, OblivTableCacheEntry *entry)
+{
+	OblivTableCacheEntry *cached;
+	Relation	mappingRel;
+	Relation	mirrorIndex;
+	Oid			mappingOid;
+	bool		found;
+
+	if (oblivTableCache == NULL)
+	{
+		HASHCTL		ctl;
+
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(OblivTableCacheEntry);
+		oblivTableCache = hash_create("oblivpg_fdw tables", 16, &ctl,
+									  HASH_ELEM | HASH_BLOBS);
+
+		CacheRegisterRelcacheCallback(oblivTableCacheCallback, (Datum) 0);
+	}
+
+	cached = (OblivTableCacheEntry *) hash_search(oblivTableCache, &ftwOid, HASH_FIND, &found);
+	if (found)
+	{
+		*entry = *cached;
+		return true;
+	}
+
+	mappingOid = getOblivMappingOid();
+	if (mappingOid == InvalidOid)
+		return false;
+
+	MemSet(entry, 0, sizeof(OblivTableCacheEntry));
+	entry->ftwOid = ftwOid;
+
+	mappingRel = heap_open(mappingOid, AccessShareLock);
+	entry->status = getOblivTableStatus(ftwOid, mappingRel);
+	entry->status.tableRelFileNode = ftwOid;
+	heap_close(mappingRel, AccessShareLock);
+
+	if (entry->status.relIndexMirrorId != InvalidOid)
+	{
+		mirrorIndex = index_open(entry->status.relIndexMirrorId, AccessShareLock);
+
+		/* the current prototype assumes a single indexed column */
+		entry->indexedColumn = mirrorIndex->rd_index->indkey.values[0];
+		entry->indexAm = mirrorIndex->rd_rel->relam;
+		entry->indexOpfamily = mirrorIndex->rd_opfamily[0];
+		entry->indexOpcintype = mirrorIndex->rd_opcintype[0];
+		entry->indexCollation = mirrorIndex->rd_indcollation[0];
+		entry->indexUnique = mirrorIndex->rd_index->indisunique;
+		if (entry->indexAm == BTREE_AM_OID)
+		{
+			entry->indexCmpProc = get_opfamily_proc(entry->indexOpfamily,
+													entry->indexOpcintype,
+													entry->indexOpcintype,
+													BTORDER_PROC);
+			entry->indexTreeHeight = _bt_getrootheight(mirrorIndex);
+		}
+
+		index_close(mirrorIndex, AccessShareLock);
+	}
+
+	/* Built aside, the invalidations above can modify the hash table. */
+	cached = (OblivTableCacheEntry *) hash_search(oblivTableCache, &ftwOid, HASH_ENTER, &found);
+	*cached = *entry;
+
+	return true;
+}
@@ -0,0 +1,200 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_trace.c
+ *	  per-backend trace of the ORAM accesses in Chrome trace format
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_trace.c
+ *
+ * When oblivpg_fdw.trace_buffer_size is set, the backend keeps its last
+ * trace_buffer_size events in a ring buffer: the start of the foreign
+ * scans, the ecalls, every block ocall with its relation and block number,
+ * and the tuples returned by the scans. The events are numbered by the
+ * statement that issued them, and obliv_trace_dump(n) returns the events of
+ * the last n statements as Chrome trace JSON, which chrome://tracing and
+ * Perfetto display as one track per statement.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "include/obliv_trace.h"
+
+#include "access/xact.h"
+#include "fmgr.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+
+typedef struct OblivTraceEvent
+{
+	uint64		statement;		/* statement that issued the event */
+	int			type;			/* OBLIV_TRACE_* */
+	Oid			relId;			/* foreign table or ORAM relation */
+	int			fileId;			/* ORAM file id, -1 if none */
+	int			blkno;			/* first block of an ocall */
+	int			count;			/* blocks of an ocall */
+	double		ts;				/* start, in microseconds */
+	double		dur;			/* duration of an ecall or ocall */
+} OblivTraceEvent;
+
+int			oblivTraceBufferSize = 0;
+
+static OblivTraceEvent *traceRing = NULL;
+static int	traceRingSize = 0;
+static uint64 traceNext = 0;	/* events recorded since the allocation */
+
+/* Statement counter, advanced when the statement start time changes */
+static uint64 traceStatement = 0;
+static TimestampTz traceStatementStart = 0;
+
+static const char *const traceNames[] = {
+	"scan",
+	"getTuple",
+	"insert",
+	"outFileRead",
+	"outFileWrite",
+	"tuple"
+};
+
+static OblivTraceEvent *traceNewEvent(int type, Oid relId);
+
+PG_FUNCTION_INFO_V1(obliv_trace_dump);
+
+bool
+oblivTraceEnabled(void)
+{
+	return oblivTraceBufferSize > 0;
+}
+
+/*
+ * Returns the slot of a new event. The ring is allocated again when the
+ * size setting changes, which drops the previous events.
+ */
+static OblivTraceEvent *
+traceNewEvent(int type, Oid relId)
+{
+	OblivTraceEvent *event;
+	TimestampTz statementStart;
+
+	if (traceRingSize != oblivTraceBufferSize)
+	{
+		if (traceRing != NULL)
+			pfree(traceRing);
+		traceRing = (OblivTraceEvent *) MemoryContextAlloc(TopMemoryContext,
+														   sizeof(OblivTraceEvent) * oblivTraceBufferSize);
+		traceRingSize = oblivTraceBufferSize;
+		traceNext = 0;
+	}
+
+	statementStart = GetCurrentStatementStartTimestamp();
+	if (statementStart != traceStatementStart)
+	{
+		traceStatementStart = statementStart;
+		traceStatement++;
+	}
+
+	event = &traceRing[traceNext % traceRingSize];
+	traceNext++;
+
+	event->statement = traceStatement;
+	event->type = type;
+	event->relId = relId;
+	event->fileId = -1;
+	event->blkno = -1;
+	event->count = 0;
+	event->dur = 0;
+
+	return event;
+}
+
+/*
+ * Records an event without duration, such as the start of a scan.
+ */
+void
+oblivTraceInstant(int type, Oid relId)
+{
+	OblivTraceEvent *event;
+	instr_time	now;
+
+	if (!oblivTraceEnabled())
+		return;
+
+	INSTR_TIME_SET_CURRENT(now);
+
+	event = traceNewEvent(type, relId);
+	event->ts = INSTR_TIME_GET_MICROSEC(now);
+}
+
+/*
+ * Records an ecall or an ocall that started at start and took duration.
+ */
+void
+oblivTraceSpan(int type, Oid relId, int fileId, int blkno, int count,
+			   instr_time *start, instr_time *duration)
+{
+	OblivTraceEvent *event;
+
+	if (!oblivTraceEnabled())
+		return;
+
+	event = traceNewEvent(type, relId);
+	event->fileId = fileId;
+	event->blkno = blkno;
+	event->count = count;
+	event->ts = INSTR_TIME_GET_MICROSEC(*start);
+	event->dur = INSTR_TIME_GET_DOUBLE(*duration) * 1000000.0;
+}
+
+/*
+ * Returns the events of the last n statements of the backend, oldest
+ * first, as Chrome trace JSON.
+ */
+Datum
+obliv_trace_dump(PG_FUNCTION_ARGS)
+{
+	int32		nstatements = PG_GETARG_INT32(0);
+	StringInfoData buf;
+	uint64		first;
+	uint64		i;
+	bool		needComma = false;
+
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	first = traceNext > (uint64) traceRingSize ? traceNext - traceRingSize : 0;
+
+	for (i = first; traceRing != NULL && i < traceNext; i++)
+	{
+		OblivTraceEvent *event = &traceRing[i % traceRingSize];
+
+		if (nstatements <= 0 || event->statement + nstatements <= traceStatement)
+			continue;
+
+		if (needComma)
+			appendStringInfoChar(&buf, ',');
+		needComma = true;
+
+		appendStringInfo(&buf, "{\"name\":\"%s\",\"cat\":\"oblivpg\",\"pid\":%d,\"tid\":" UINT64_FORMAT ",\"ts\":%.3f,",
+						 traceNames[event->type], MyProcPid, event->statement, event->ts);
+
+		if (event->type == OBLIV_TRACE_SCAN || event->type == OBLIV_TRACE_TUPLE)
+			appendStringInfoString(&buf, "\"ph\":\"i\",\"s\":\"t\",");
+		else
+			appendStringInfo(&buf, "\"ph\":\"X\",\"dur\":%.3f,", event->dur);
+
+		appendStringInfo(&buf, "\"args\":{\"relation\":%u", event->relId);
+		if (event->fileId >= 0)
+			appendStringInfo(&buf, ",\"file\":%d,\"blkno\":%d,\"nblocks\":%d",
+							 event->fileId, event->blkno, event->count);
+		appendStringInfoString(&buf, "}}");
+	}
+
+	appendStringInfoString(&buf, "]}");
+
+	PG_RETURN_TEXT_P(cstring_to_text_with_len(buf.data, buf.len));
+}
@@ -0,0 +1,421 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_treetop.c
+ *	  shared-memory cache of the top levels of the ORAM trees
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_treetop.c
+ *
+ * Every ORAM access reads and writes the buckets of the top levels of the
+ * tree, whatever leaf it goes to. This cache keeps the encrypted buckets of
+ * the top oblivpg_fdw.treetop_levels levels of each ORAM file in shared
+ * memory, so these blocks are served and absorbed by the ocalls without
+ * going through the storage backend. The access pattern seen by the storage
+ * only loses the blocks that every path has in common.
+ *
+ * The SOE stores a tree in heap order with one bucket per block, so the top
+ * k levels are the first 2^k - 1 blocks of the file. Forest ORAM spreads
+ * its blocks over several trees and is not cached. Dirty blocks are written
+ * back through the storage backend by obliv_sync, obliv_checkpoint and when
+ * the file is closed or initialized again.
+ *
+ * The cache is allocated when the library is in shared_preload_libraries
+ * and oblivpg_fdw.treetop_levels is set; otherwise every block goes to the
+ * storage backend.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "include/obliv_treetop.h"
+
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/relfilenode.h"
+#include "storage/shmem.h"
+#include "utils/rel.h"
+
+#define OBLIV_TREETOP_TRANCHE "oblivpg_fdw treetop"
+
+/* Dirty blocks written back by a single storage request */
+#define TREETOP_FLUSH_BLOCKS 1024
+
+typedef struct OblivTreetopEntry
+{
+	RelFileNode node;			/* cached relation, relNode is InvalidOid if free */
+	int			refcount;		/* backends using the entry */
+} OblivTreetopEntry;
+
+typedef struct OblivTreetopShared
+{
+	LWLock	   *lock;			/* protects the entries, bitmaps and blocks */
+	LWLock	   *flushLock;		/* serializes the write-backs */
+	BlockNumber nblocks;		/* blocks cached for each file */
+	OblivTreetopEntry entries[OBLIV_TREETOP_FILES];
+} OblivTreetopShared;
+
+int			oblivTreetopLevels = 0;
+
+static OblivTreetopShared *treetop = NULL;
+static uint8 *treetopValid;		/* OBLIV_TREETOP_FILES bitmaps of nblocks */
+static uint8 *treetopDirty;		/* OBLIV_TREETOP_FILES bitmaps of nblocks */
+static char *treetopBlocks;		/* OBLIV_TREETOP_FILES * nblocks blocks */
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static BlockNumber treetopNBlocks(void);
+static Size treetopBitmapSize(void);
+static Size treetopShmemSize(void);
+static void treetopShmemStartup(void);
+
+#define TREETOP_BIT(bitmap, slot, blkno) \
+	((bitmap) + (slot) * treetopBitmapSize() + (blkno) / 8)
+#define TREETOP_TEST(bitmap, slot, blkno) \
+	((*TREETOP_BIT(bitmap, slot, blkno) & (1 << ((blkno) % 8))) != 0)
+#define TREETOP_SET(bitmap, slot, blkno) \
+	(*TREETOP_BIT(bitmap, slot, blkno) |= (1 << ((blkno) % 8)))
+#define TREETOP_CLEAR(bitmap, slot, blkno) \
+	(*TREETOP_BIT(bitmap, slot, blkno) &= ~(1 << ((blkno) % 8)))
+#define TREETOP_BLOCK(slot, blkno) \
+	(treetopBlocks + ((Size) (slot) * treetop->nblocks + (blkno)) * BLCKSZ)
+
+static BlockNumber
+treetopNBlocks(void)
+{
+	return ((BlockNumber) 1 << oblivTreetopLevels) - 1;
+}
+
+static Size
+treetopBitmapSize(void)
+{
+	return (treetopNBlocks() + 7) / 8;
+}
+
+static Size
+treetopShmemSize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(OblivTreetopShared));
+	size = add_size(size, MAXALIGN(mul_size(2 * OBLIV_TREETOP_FILES, treetopBitmapSize())));
+	size = add_size(size, mul_size(mul_size(OBLIV_TREETOP_FILES, treetopNBlocks()), BLCKSZ));
+
+	return size;
+}
+
+/*
+ * Requests the shared memory of the cache. Called by _PG_init once the
+ * oblivpg_fdw.treetop_levels setting is defined.
+ */
+void
+oblivTreetopRequest(void)
+{
+	if (!process_shared_preload_libraries_in_progress || oblivTreetopLevels == 0)
+		return;
+
+	RequestAddinShmemSpace(treetopShmemSize());
+	RequestNamedLWLockTranche(OBLIV_TREETOP_TRANCHE, 2);
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = treetopShmemStartup;
+}
+
+static void
+treetopShmemStartup(void)
+{
+	bool		found;
+	char	   *base;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	treetop = ShmemInitStruct("oblivpg_fdw treetop", treetopShmemSize(), &found);
+	base = (char *) treetop;
+
+	if (!found)
+	{
+		memset(treetop, 0, MAXALIGN(sizeof(OblivTreetopShared)) +
+			   MAXALIGN(mul_size(2 * OBLIV_TREETOP_FILES, treetopBitmapSize())));
+		treetop->lock = &(GetNamedLWLockTranche(OBLIV_TREETOP_TRANCHE))[0].lock;
+		treetop->flushLock = &(GetNamedLWLockTranche(OBLIV_TREETOP_TRANCHE))[1].lock;
+		treetop->nblocks = treetopNBlocks();
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+
+	treetopValid = (uint8 *) (base + MAXALIGN(sizeof(OblivTreetopShared)));
+	treetopDirty = treetopValid + OBLIV_TREETOP_FILES * treetopBitmapSize();
+	treetopBlocks = base + MAXALIGN(sizeof(OblivTreetopShared)) +
+		MAXALIGN(mul_size(2 * OBLIV_TREETOP_FILES, treetopBitmapSize()));
+
+	elog(DEBUG1, "Treetop cache of %u blocks per oblivious file", treetop->nblocks);
+}
+
+/*
+ * Assigns a cache entry to the relation of an ORAM file. Backends that use
+ * the same relation share its entry. The file is not cached if all the
+ * entries are in use.
+ */
+void
+oblivTreetopAcquire(OblivFile *file)
+{
+	RelFileNode node;
+	int			slot = -1;
+	int			freeSlot = -1;
+	int			i;
+
+	file->treetopSlot = -1;
+
+	if (treetop == NULL)
+		return;
+
+	RelationOpenSmgr(file->rel);
+	node = file->rel->rd_node;
+
+	LWLockAcquire(treetop->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < OBLIV_TREETOP_FILES; i++)
+	{
+		if (treetop->entries[i].refcount > 0 && RelFileNodeEquals(treetop->entries[i].node, node))
+			slot = i;
+		else if (treetop->entries[i].refcount == 0 && freeSlot < 0)
+			freeSlot = i;
+	}
+
+	if (slot < 0 && freeSlot >= 0)
+	{
+		slot = freeSlot;
+		treetop->entries[slot].node = node;
+		memset(TREETOP_BIT(treetopValid, slot, 0), 0, treetopBitmapSize());
+		memset(TREETOP_BIT(treetopDirty, slot, 0), 0, treetopBitmapSize());
+	}
+
+	if (slot >= 0)
+		treetop->entries[slot].refcount++;
+
+	LWLockRelease(treetop->lock);
+
+	file->treetopSlot = slot;
+
+	if (slot < 0)
+		elog(DEBUG1, "No treetop cache entry left for oblivious file %s", file->name);
+}
+
+/*
+ * Writes back the dirty blocks of the file and releases its entry. The
+ * cached blocks are dropped when the last backend releases the entry.
+ */
+void
+oblivTreetopRelease(OblivFile *file)
+{
+	int			slot = file->treetopSlot;
+
+	if (slot < 0)
+		return;
+
+	oblivTreetopFlush(file);
+
+	LWLockAcquire(treetop->lock, LW_EXCLUSIVE);
+
+	if (--treetop->entries[slot].refcount == 0)
+	{
+		treetop->entries[slot].node.relNode = InvalidOid;
+		memset(TREETOP_BIT(treetopValid, slot, 0), 0, treetopBitmapSize());
+	}
+
+	LWLockRelease(treetop->lock);
+
+	file->treetopSlot = -1;
+}
+
+/*
+ * Drops the cached blocks of the relation of the file, dirty or not, from
+ * the entry of every backend. Called before the file is initialized or
+ * allocated again, so that no backend serves the top levels of the
+ * previous tree. The flush lock waits for a write-back in progress, which
+ * would otherwise overwrite the new image.
+ */
+void
+oblivTreetopInvalidate(OblivFile *file)
+{
+	RelFileNode node;
+	int			i;
+
+	if (treetop == NULL)
+		return;
+
+	RelationOpenSmgr(file->rel);
+	node = file->rel->rd_node;
+
+	LWLockAcquire(treetop->flushLock, LW_EXCLUSIVE);
+	LWLockAcquire(treetop->lock, LW_EXCLUSIVE);
+
+	for (i = 0; i < OBLIV_TREETOP_FILES; i++)
+	{
+		if (treetop->entries[i].refcount > 0 && RelFileNodeEquals(treetop->entries[i].node, node))
+		{
+			memset(TREETOP_BIT(treetopValid, i, 0), 0, treetopBitmapSize());
+			memset(TREETOP_BIT(treetopDirty, i, 0), 0, treetopBitmapSize());
+		}
+	}
+
+	LWLockRelease(treetop->lock);
+	LWLockRelease(treetop->flushLock);
+}
+
+/*
+ * Writes the dirty cached blocks of the file through its storage backend,
+ * in batches of TREETOP_FLUSH_BLOCKS blocks. The blocks of a batch are
+ * copied and marked clean under the lock and written after releasing it,
+ * so the accesses of the other backends do not wait for the storage. A
+ * block written again in the meantime is dirty again and goes in a later
+ * flush. The flush lock keeps a flush from writing an older copy of a
+ * block after a concurrent one.
+ */
+void
+oblivTreetopFlush(OblivFile *file)
+{
+	int			slot = file->treetopSlot;
+	int		   *blknos;
+	char	   *pages;
+	int			ndirty;
+	int			nwritten = 0;
+	BlockNumber blkno = 0;
+	int			offset;
+
+	if (slot < 0)
+		return;
+
+	blknos = (int *) palloc(sizeof(int) * TREETOP_FLUSH_BLOCKS);
+	pages = (char *) palloc((Size) TREETOP_FLUSH_BLOCKS * BLCKSZ);
+
+	LWLockAcquire(treetop->flushLock, LW_EXCLUSIVE);
+
+	while (blkno < treetop->nblocks)
+	{
+		ndirty = 0;
+
+		LWLockAcquire(treetop->lock, LW_EXCLUSIVE);
+
+		for (; blkno < treetop->nblocks && ndirty < TREETOP_FLUSH_BLOCKS; blkno++)
+		{
+			if (!TREETOP_TEST(treetopDirty, slot, blkno))
+				continue;
+
+			memcpy(pages + ((Size) ndirty * BLCKSZ), TREETOP_BLOCK(slot, blkno), BLCKSZ);
+			TREETOP_CLEAR(treetopDirty, slot, blkno);
+			blknos[ndirty++] = blkno;
+		}
+
+		LWLockRelease(treetop->lock);
+
+		if (ndirty == 0)
+			continue;
+
+		PG_TRY();
+		{
+			file->storage->writev(file, blknos, ndirty, pages, BLCKSZ);
+		}
+		PG_CATCH();
+		{
+			/* The blocks stay dirty for the next flush. */
+			LWLockAcquire(treetop->lock, LW_EXCLUSIVE);
+			for (offset = 0; offset < ndirty; offset++)
+				TREETOP_SET(treetopDirty, slot, blknos[offset]);
+			LWLockRelease(treetop->lock);
+
+			PG_RE_THROW();
+		}
+		PG_END_TRY();
+
+		nwritten += ndirty;
+	}
+
+	LWLockRelease(treetop->flushLock);
+
+	if (nwritten > 0)
+		elog(DEBUG1, "Wrote back %d treetop blocks of oblivious file %s", nwritten, file->name);
+
+	pfree(blknos);
+	pfree(pages);
+}
+
+/*
+ * Copies a cached block to the enclave buffer. Returns false if the block
+ * is not cached.
+ */
+bool
+oblivTreetopRead(OblivFile *file, BlockNumber blkno, char *page, int pageSize)
+{
+	int			slot = file->treetopSlot;
+	bool		hit;
+
+	if (slot < 0 || blkno >= treetop->nblocks)
+		return false;
+
+	LWLockAcquire(treetop->lock, LW_SHARED);
+
+	hit = TREETOP_TEST(treetopValid, slot, blkno);
+	if (hit)
+		memcpy(page, TREETOP_BLOCK(slot, blkno), pageSize);
+
+	LWLockRelease(treetop->lock);
+
+	return hit;
+}
+
+/*
+ * Caches a whole block read from the storage backend.
+ */
+void
+oblivTreetopFill(OblivFile *file, BlockNumber blkno, const char *page, int pageSize)
+{
+	int			slot = file->treetopSlot;
+
+	if (slot < 0 || blkno >= treetop->nblocks || pageSize != BLCKSZ)
+		return;
+
+	LWLockAcquire(treetop->lock, LW_EXCLUSIVE);
+
+	if (!TREETOP_TEST(treetopValid, slot, blkno))
+	{
+		memcpy(TREETOP_BLOCK(slot, blkno), page, BLCKSZ);
+		TREETOP_SET(treetopValid, slot, blkno);
+	}
+
+	LWLockRelease(treetop->lock);
+}
+
+/*
+ * Absorbs the write of a block of the top levels. Returns false if the
+ * block is not cached and has to be written by the storage backend, which
+ * is also the case of a partial write of a block that is not cached.
+ */
+bool
+oblivTreetopWrite(OblivFile *file, BlockNumber blkno, const char *page, int pageSize)
+{
+	int			slot = file->treetopSlot;
+	bool		absorbed = false;
+
+	if (slot < 0 || blkno >= treetop->nblocks)
+		return false;
+
+	LWLockAcquire(treetop->lock, LW_EXCLUSIVE);
+
+	if (pageSize == BLCKSZ || TREETOP_TEST(treetopValid, slot, blkno))
+	{
+		memcpy(TREETOP_BLOCK(slot, blkno), page, pageSize);
+		TREETOP_SET(treetopValid, slot, blkno);
+		TREETOP_SET(treetopDirty, slot, blkno);
+		absorbed = true;
+	}
+
+	LWLockRelease(treetop->lock);
+
+	return absorbed;
+}
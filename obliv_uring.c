@@ -0,0 +1,397 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_uring.c
+ *	  io_uring storage backend for the ORAM files
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/obliv_uring.c
+ *
+ * The ORAM blocks are encrypted and never useful to other backends, so this
+ * backend bypasses shared buffers. It owns the segment files of the ORAM
+ * relations and submits the blocks of a path as a single io_uring batch.
+ * The blocks are staged in a pool of registered buffers aligned for
+ * O_DIRECT, which is used when oblivpg_fdw.direct_io is set.
+ *
+ * The backend is compiled when the library is built with URING=1.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#ifdef OBLIV_URING
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <liburing.h>
+
+#include "include/obliv_storage.h"
+
+#include "storage/bufpage.h"
+#include "storage/fd.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+/* Maximum number of blocks submitted in a single io_uring batch. */
+#define OBLIV_URING_DEPTH 128
+
+/* Alignment of the registered buffers required by O_DIRECT. */
+#define OBLIV_URING_ALIGN 4096
+
+static struct io_uring ring;
+static bool ringInitialized = false;
+
+/* OBLIV_URING_DEPTH registered buffers of BLCKSZ bytes. */
+static char *slots = NULL;
+
+static void uringSetup(void);
+static void uringAbort(int inflight);
+static void uringSubmit(OblivFile *file, const int *blknos, int nblocks, bool isWrite);
+static void uringAttach(OblivFile *file);
+static void uringDetach(OblivFile *file);
+static void uringReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize);
+static void uringWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize);
+static void uringPrefetch(OblivFile *file, const int *blknos, int nblocks);
+static void uringSync(OblivFile *file);
+
+const OblivStorageRoutine oblivUringStorage = {
+	"uring",
+	uringAttach,
+	uringDetach,
+	uringReadv,
+	uringWritev,
+	uringPrefetch,
+	uringSync,
+	NULL,
+	NULL
+};
+
+
+/*
+ * Creates the ring and registers the staging buffers. The ring is shared by
+ * all the ORAM files of the backend and lives until the backend exits.
+ */
+static void
+uringSetup(void)
+{
+	struct iovec iovs[OBLIV_URING_DEPTH];
+	char	   *raw;
+	int			ret;
+	int			slot;
+
+	if (ringInitialized)
+		return;
+
+	if (slots == NULL)
+	{
+		raw = MemoryContextAlloc(TopMemoryContext, OBLIV_URING_DEPTH * BLCKSZ + OBLIV_URING_ALIGN);
+		slots = (char *) TYPEALIGN(OBLIV_URING_ALIGN, raw);
+	}
+
+	ret = io_uring_queue_init(OBLIV_URING_DEPTH, &ring, 0);
+	if (ret < 0)
+	{
+		errno = -ret;
+		ereport(ERROR,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("could not initialize io_uring: %m")));
+	}
+
+	for (slot = 0; slot < OBLIV_URING_DEPTH; slot++)
+	{
+		iovs[slot].iov_base = slots + (slot * BLCKSZ);
+		iovs[slot].iov_len = BLCKSZ;
+	}
+
+	ret = io_uring_register_buffers(&ring, iovs, OBLIV_URING_DEPTH);
+	if (ret < 0)
+	{
+		io_uring_queue_exit(&ring);
+		errno = -ret;
+		ereport(ERROR,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("could not register io_uring buffers: %m")));
+	}
+
+	ringInitialized = true;
+}
+
+/*
+ * Tears down the ring after a failed batch, reaping the inflight requests
+ * first: they complete into the staging slots, and the unsubmitted ones
+ * would go with the next batch. If the requests cannot be reaped, the slots
+ * are left to the kernel and new ones are allocated. The next access sets
+ * up a new ring.
+ */
+static void
+uringAbort(int inflight)
+{
+	struct io_uring_cqe *cqe;
+	int			ret;
+
+	while (inflight > 0)
+	{
+		ret = io_uring_wait_cqe(&ring, &cqe);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0)
+			break;
+		io_uring_cqe_seen(&ring, cqe);
+		inflight--;
+	}
+
+	io_uring_queue_exit(&ring);
+	ringInitialized = false;
+
+	if (inflight > 0)
+		slots = NULL;
+}
+
+static void
+uringAttach(OblivFile *file)
+{
+	OblivSegments *segs;
+	int			flags = O_RDWR | PG_BINARY;
+
+	uringSetup();
+
+	oblivDropBuffers(file);
+
+#ifdef O_DIRECT
+	if (oblivDirectIO)
+		flags |= O_DIRECT;
+#endif
+
+	segs = (OblivSegments *) MemoryContextAllocZero(TopMemoryContext, sizeof(OblivSegments));
+	oblivOpenSegments(file, flags, segs);
+	file->storagePrivate = segs;
+
+	elog(DEBUG1, "io_uring storage attached to %s with %u blocks", file->name, segs->nblocks);
+}
+
+static void
+uringDetach(OblivFile *file)
+{
+	OblivSegments *segs = (OblivSegments *) file->storagePrivate;
+
+	oblivCloseSegments(file, segs);
+	pfree(segs);
+}
+
+/*
+ * Submits the reads or writes of at most OBLIV_URING_DEPTH blocks, block i
+ * using the staging slot i, and waits for all of them to complete.
+ */
+static void
+uringSubmit(OblivFile *file, const int *blknos, int nblocks, bool isWrite)
+{
+	OblivSegments *segs = (OblivSegments *) file->storagePrivate;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	int			offset;
+	int			ret;
+	int			failed = 0;
+	int			failedRes = 0;
+
+	Assert(nblocks <= OBLIV_URING_DEPTH);
+
+	/* Validate the whole batch before queueing any request on the ring. */
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		if ((BlockNumber) blknos[offset] >= segs->nblocks)
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_DATA_CORRUPTED),
+					 errmsg("Enclave requested block %d of oblivious file %s with %u blocks",
+							blknos[offset], file->name, segs->nblocks)));
+		}
+	}
+
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		BlockNumber blkno = blknos[offset];
+		int			fd;
+		off_t		seekpos;
+
+		fd = segs->fds[blkno / RELSEG_SIZE];
+		seekpos = (off_t) BLCKSZ * (blkno % RELSEG_SIZE);
+
+		sqe = io_uring_get_sqe(&ring);
+		if (isWrite)
+			io_uring_prep_write_fixed(sqe, fd, slots + (offset * BLCKSZ), BLCKSZ, seekpos, offset);
+		else
+			io_uring_prep_read_fixed(sqe, fd, slots + (offset * BLCKSZ), BLCKSZ, seekpos, offset);
+	}
+
+	/* The signals of the backend interrupt the waits, which are retried. */
+	do
+		ret = io_uring_submit_and_wait(&ring, nblocks);
+	while (ret == -EINTR);
+
+	if (ret < 0)
+	{
+		uringAbort(0);
+		errno = -ret;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not submit io_uring requests for oblivious file %s: %m",
+						file->name)));
+	}
+	else if (ret != nblocks)
+	{
+		uringAbort(ret);
+		ereport(ERROR,
+				(errcode(ERRCODE_SYSTEM_ERROR),
+				 errmsg("io_uring accepted %d of %d requests for oblivious file %s",
+						ret, nblocks, file->name)));
+	}
+
+	/* Every completion is reaped before reporting an error. */
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		do
+			ret = io_uring_wait_cqe(&ring, &cqe);
+		while (ret == -EINTR);
+
+		if (ret < 0)
+		{
+			uringAbort(nblocks - offset);
+			errno = -ret;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not wait for io_uring completion: %m")));
+		}
+
+		if (cqe->res != BLCKSZ)
+		{
+			failed++;
+			failedRes = cqe->res;
+		}
+		io_uring_cqe_seen(&ring, cqe);
+	}
+
+	if (failed > 0 && failedRes < 0)
+	{
+		errno = -failedRes;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("%d io_uring %s of oblivious file %s failed: %m",
+						failed, isWrite ? "writes" : "reads", file->name)));
+	}
+	else if (failed > 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("%d io_uring %s of oblivious file %s transferred %d of %d bytes",
+						failed, isWrite ? "writes" : "reads", file->name, failedRes, BLCKSZ)));
+	}
+}
+
+static void
+uringReadv(OblivFile *file, const int *blknos, int nblocks, char *pages, int pageSize)
+{
+	int			first;
+	int			offset;
+	int			batch;
+
+	/* The slots hold a single block. */
+	if (pageSize > BLCKSZ)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("io_uring storage reads at most a block, requested %d bytes",
+						pageSize)));
+	}
+
+	for (first = 0; first < nblocks; first += batch)
+	{
+		batch = Min(nblocks - first, OBLIV_URING_DEPTH);
+
+		uringSubmit(file, blknos + first, batch, false);
+
+		for (offset = 0; offset < batch; offset++)
+			memcpy(pages + ((first + offset) * pageSize), slots + (offset * BLCKSZ), pageSize);
+	}
+}
+
+static void
+uringWritev(OblivFile *file, const int *blknos, int nblocks, const char *pages, int pageSize)
+{
+	int			first;
+	int			offset;
+	int			batch;
+
+	/* Partial pages would need a read before the write. */
+	if (pageSize != BLCKSZ)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("io_uring storage only writes whole blocks, requested %d bytes",
+						pageSize)));
+	}
+
+	for (first = 0; first < nblocks; first += batch)
+	{
+		batch = Min(nblocks - first, OBLIV_URING_DEPTH);
+
+		for (offset = 0; offset < batch; offset++)
+		{
+			char	   *slot = slots + (offset * BLCKSZ);
+
+			memcpy(slot, pages + ((first + offset) * pageSize), BLCKSZ);
+			PageSetChecksumInplace((Page) slot, blknos[first + offset]);
+		}
+
+		uringSubmit(file, blknos + first, batch, true);
+	}
+}
+
+/*
+ * With buffered I/O the kernel can start reading the blocks of the next
+ * path. There is no page cache to warm up with O_DIRECT.
+ */
+static void
+uringPrefetch(OblivFile *file, const int *blknos, int nblocks)
+{
+#ifdef USE_POSIX_FADVISE
+	OblivSegments *segs = (OblivSegments *) file->storagePrivate;
+	int			offset;
+
+	if (oblivDirectIO)
+		return;
+
+	for (offset = 0; offset < nblocks; offset++)
+	{
+		BlockNumber blkno = blknos[offset];
+
+		if (blkno >= segs->nblocks)
+			continue;
+
+		(void) posix_fadvise(segs->fds[blkno / RELSEG_SIZE],
+							 (off_t) BLCKSZ * (blkno % RELSEG_SIZE),
+							 BLCKSZ, POSIX_FADV_WILLNEED);
+	}
+#endif
+}
+
+static void
+uringSync(OblivFile *file)
+{
+	OblivSegments *segs = (OblivSegments *) file->storagePrivate;
+	int			seg;
+
+	for (seg = 0; seg < segs->nsegs; seg++)
+	{
+		if (pg_fsync(segs->fds[seg]) != 0)
+		{
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not fsync oblivious file %s: %m", file->name)));
+		}
+	}
+}
+
+#endif							/* OBLIV_URING */
@@ -45,6 +45,75 @@ RETURNS void
 AS 'MODULE_PATHNAME', 'attach_shmem'
 LANGUAGE C STRICT;
 
+CREATE FUNCTION obliv_sync()
+RETURNS void
+AS 'MODULE_PATHNAME', 'obliv_sync'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION obliv_checkpoint(oid)
+RETURNS void
+AS 'MODULE_PATHNAME', 'obliv_checkpoint'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION obliv_restore(oid)
+RETURNS int4
+AS 'MODULE_PATHNAME', 'obliv_restore'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION obliv_stat_tables(
+    OUT ftw_oid oid,
+    OUT lookups int8,
+    OUT inserts int8,
+    OUT ecalls int8,
+    OUT ocall_reads int8,
+    OUT ocall_writes int8,
+    OUT blocks_read int8,
+    OUT blocks_written int8,
+    OUT bytes int8,
+    OUT scan_p50_us float8,
+    OUT scan_p99_us float8,
+    OUT scan_p999_us float8,
+    OUT insert_p50_us float8,
+    OUT insert_p99_us float8,
+    OUT insert_p999_us float8,
+    OUT read_p50_us float8,
+    OUT read_p99_us float8,
+    OUT read_p999_us float8,
+    OUT write_p50_us float8,
+    OUT write_p99_us float8,
+    OUT write_p999_us float8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'obliv_stat_tables'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE VIEW pg_stat_oblivious AS
+  SELECT s.ftw_oid, c.relname, s.lookups, s.inserts, s.ecalls,
+         s.ocall_reads, s.ocall_writes, s.blocks_read, s.blocks_written,
+         s.bytes,
+         s.scan_p50_us, s.scan_p99_us, s.scan_p999_us,
+         s.insert_p50_us, s.insert_p99_us, s.insert_p999_us,
+         s.read_p50_us, s.read_p99_us, s.read_p999_us,
+         s.write_p50_us, s.write_p99_us, s.write_p999_us
+  FROM obliv_stat_tables() s LEFT JOIN pg_class c ON c.oid = s.ftw_oid;
+
+CREATE FUNCTION obliv_stat_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'obliv_stat_reset'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION obliv_stat_reset() FROM PUBLIC;
+
+CREATE FUNCTION obliv_trace_dump(statements int4 DEFAULT 1)
+RETURNS json
+AS 'MODULE_PATHNAME', 'obliv_trace_dump'
+LANGUAGE C STRICT VOLATILE;
+
+CREATE FUNCTION obliv_calibrate(loops int4 DEFAULT 1000,
+    OUT ecall_usec float8, OUT ocall_usec float8, OUT block_usec float8)
+RETURNS record
+AS 'MODULE_PATHNAME', 'obliv_calibrate'
+LANGUAGE C STRICT;
+
 
 
 DROP SERVER IF EXISTS obliv;
@@ -79,6 +148,15 @@ create table obl_ftw(
 	init 	boolean
 );
 
+CREATE FUNCTION obliv_mapping_invalidate()
+RETURNS trigger
+AS 'MODULE_PATHNAME', 'obliv_mapping_invalidate'
+LANGUAGE C STRICT;
+
+CREATE TRIGGER obl_ftw_invalidate
+AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON obl_ftw
+FOR EACH STATEMENT EXECUTE PROCEDURE obliv_mapping_invalidate();
+
 /*CREATE FOREIGN TABLE ftw_users(
 	id integer,
 	name char(50),
@@ -12,36 +12,65 @@
  */
 
 
+#include <float.h>
+#include <limits.h>
 #include <string.h>
 
 #include "include/obliv_status.h"
 #include "include/obliv_utils.h"
 #include "include/oblivpg_fdw.h"
 #include "include/obliv_ocalls.h"
+#include "include/obliv_storage.h"
+#include "include/obliv_checkpoint.h"
+#include "include/obliv_treetop.h"
+#include "include/obliv_cost.h"
+#include "include/obliv_instrument.h"
+#include "include/obliv_stats.h"
+#include "include/obliv_probes.h"
+#include "include/obliv_trace.h"
 
 #include "access/htup.h"
 #include "access/htup_details.h"
 #include "access/tuptoaster.h"
 #include "access/nbtree.h"
+#include "access/stratnum.h"
 #include "catalog/catalog.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_type.h"
 
 #include "postgres.h"
 #include "access/xact.h"
 #include "catalog/pg_namespace_d.h"
 #include "commands/explain.h"
+#include "commands/trigger.h"
 #include "foreign/fdwapi.h"
+#include "funcapi.h"
+#include "portability/instr_time.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "optimizer/pathnode.h"
 #include "optimizer/planmain.h"
+#include "executor/executor.h"
 #include "executor/tuptable.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/paths.h"
+#include "optimizer/var.h"
+#include "utils/datum.h"
+#include "utils/memutils.h"
+#include "utils/selfuncs.h"
 #include "nodes/nodes.h"
 #include "nodes/primnodes.h"
 #include "storage/shmem.h"
 #include "storage/smgr.h"
 #include "optimizer/clauses.h"
+#include "optimizer/cost.h"
+#include "optimizer/plancat.h"
 #include "optimizer/restrictinfo.h"
 
     
@@ -127,12 +156,11 @@ PG_FUNCTION_INFO_V1(close_enclave);
 PG_FUNCTION_INFO_V1(load_blocks);
 PG_FUNCTION_INFO_V1(attach_shmem);
 PG_FUNCTION_INFO_V1(set_nextterm);
-
-/* Default CPU cost to start up a foreign query. */
-#define DEFAULT_FDW_STARTUP_COST	100.0
-
-/* Default CPU cost to start up a foreign query. */
-#define DEFAULT_OBLIV_FDW_TOTAL_COST	100.0
+PG_FUNCTION_INFO_V1(obliv_sync);
+PG_FUNCTION_INFO_V1(obliv_checkpoint);
+PG_FUNCTION_INFO_V1(obliv_restore);
+PG_FUNCTION_INFO_V1(obliv_mapping_invalidate);
+PG_FUNCTION_INFO_V1(obliv_calibrate);
 
 /* Predefined max tuple size for sgx to copy the real tuple to*/
 #define MAX_TUPLE_SIZE 8070
@@ -144,6 +172,10 @@ int			opmode;
 int			type_op;
 int         queueOid;
 
+/* Foreign table and mirror table of the ORAM held by the enclave */
+static Oid	soeTableOid = InvalidOid;
+static Oid	soeMirrorOid = InvalidOid;
+
 //Inter process memory  shared hash
 static STerm *term_state= NULL;
 
@@ -163,6 +195,197 @@ sgx_enclave_id_t enclave_id = 0;
 void
 _PG_init()
 {
+	DefineCustomEnumVariable("oblivpg_fdw.storage",
+							 "Storage backend used for the ORAM block I/O.",
+							 "The backend is assigned to the ORAM files when init_soe runs.",
+							 &oblivStorageKind,
+							 OBLIV_STORAGE_BUFMGR,
+							 oblivStorageOptions,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("oblivpg_fdw.direct_io",
+							 "Opens the ORAM files with O_DIRECT on the storage backends that bypass shared buffers.",
+							 NULL,
+							 &oblivDirectIO,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomStringVariable("oblivpg_fdw.remote_address",
+							   "Address of the block server of the remote storage backend.",
+							   "host:port or the path of a Unix socket.",
+							   &oblivRemoteAddress,
+							   "",
+							   PGC_SUSET,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	DefineCustomIntVariable("oblivpg_fdw.remote_pipeline_depth",
+							"Writes and prefetches sent to the block server without waiting for their response.",
+							NULL,
+							&oblivRemotePipelineDepth,
+							16,
+							1,
+							1024,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("oblivpg_fdw.remote_timeout",
+							"Time to wait for the block server before dropping the connection.",
+							"Zero waits forever.",
+							&oblivRemoteTimeout,
+							0,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("oblivpg_fdw.treetop_levels",
+							"Number of top levels of each ORAM tree kept in the shared treetop cache.",
+							"Requires oblivpg_fdw in shared_preload_libraries.",
+							&oblivTreetopLevels,
+							0,
+							0,
+							20,
+							PGC_POSTMASTER,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomRealVariable("oblivpg_fdw.ecall_cost",
+							 "Sets the planner's estimate of the cost of an enclave transition.",
+							 "Set by obliv_calibrate() from the host measurements.",
+							 &oblivEcallCost,
+							 2.0,
+							 0.0,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomRealVariable("oblivpg_fdw.ocall_cost",
+							 "Sets the planner's estimate of the cost of an ocall issued by the enclave.",
+							 "Set by obliv_calibrate() from the host measurements.",
+							 &oblivOcallCost,
+							 2.0,
+							 0.0,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomRealVariable("oblivpg_fdw.block_cost",
+							 "Sets the planner's estimate of the cost of reading or writing an ORAM block.",
+							 NULL,
+							 &oblivBlockCost,
+							 1.0,
+							 0.0,
+							 DBL_MAX,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("oblivpg_fdw.trace_buffer_size",
+							"Number of ORAM trace events kept by each backend.",
+							"The events are returned by obliv_trace_dump(). Zero disables the trace.",
+							&oblivTraceBufferSize,
+							0,
+							0,
+							1000000,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("oblivpg_fdw.inject_latency",
+							"Storage latency in microseconds added to each ORAM block request.",
+							"Zero disables the latency injection.",
+							&oblivInjectLatency,
+							0,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomEnumVariable("oblivpg_fdw.inject_distribution",
+							 "Distribution of the injected storage latency.",
+							 "oblivpg_fdw.inject_latency is the mean of the distribution.",
+							 &oblivInjectDistribution,
+							 OBLIV_INJECT_FIXED,
+							 oblivInjectOptions,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomIntVariable("oblivpg_fdw.inject_queue_depth",
+							"Blocks of an ORAM request served in parallel by the injected storage.",
+							NULL,
+							&oblivInjectQueueDepth,
+							1,
+							1,
+							INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("oblivpg_fdw.inject_bandwidth",
+							"Bandwidth cap in kB/s of the injected storage.",
+							"Zero disables the bandwidth cap.",
+							&oblivInjectBandwidth,
+							0,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomStringVariable("oblivpg_fdw.capture_file",
+							   "Captures the ORAM block accesses of each backend to <capture_file>.<pid>.",
+							   "The captures are replayed by tools/obliv_replay. Empty disables the capture.",
+							   &oblivCaptureFile,
+							   "",
+							   PGC_SUSET,
+							   0,
+							   NULL,
+							   NULL,
+							   NULL);
+
+	EmitWarningsOnPlaceholders("oblivpg_fdw");
+
+	oblivTreetopRequest();
+	oblivStatsRequest();
 }
 
 /**
@@ -197,6 +420,57 @@ typedef TreeConfig *TConfig;
 /* Assuming a default tree hight to allocate to fanouts. This is reallocated for trees with more levels. */
 #define DTHeight 3
 
+/*
+ * Clause of a scan on the indexed column, with the column on the left of
+ * the operator.
+ */
+typedef struct OblivScanKey
+{
+	int			strategy;		/* btree strategy, 0 for other operators */
+	Oid			opno;
+	Oid			collation;
+	ExprState  *valueExpr;		/* value compared with the column */
+	bool		isArray;		/* valueExpr is an array of equality keys */
+	Oid			elemType;		/* element type of the array */
+} OblivScanKey;
+
+/*
+ * Bounds on the indexed column collected from the scan keys.
+ */
+typedef struct OblivScanBounds
+{
+	bool		hasEquality;
+	bool		hasLow;
+	bool		lowInclusive;
+	Datum		low;
+	bool		hasHigh;
+	bool		highInclusive;
+	Datum		high;
+} OblivScanBounds;
+
+/*
+ * Comparison of the keys of an array, with the comparison function of the
+ * index or, when there is none, the bytes sent to the enclave.
+ */
+typedef struct OblivMultiKeySort
+{
+	FmgrInfo   *cmpProc;		/* NULL to compare the bytes */
+	Oid			collation;
+} OblivMultiKeySort;
+
+/*
+ * Indexed column of a foreign table and the operator family of its mirror
+ * index, used by the planner callbacks.
+ */
+typedef struct OblivIndexInfo
+{
+	AttrNumber	attnum;			/* indexed column */
+	Oid			relam;			/* access method of the mirror index */
+	Oid			opfamily;
+	Oid			opcintype;
+	Oid			collation;
+} OblivIndexInfo;
+
 
 
 
@@ -232,6 +506,16 @@ static bool obliviousIsForeignScanParallelSafe(PlannerInfo *root,
 
 /* Helper function */
 static int	getindexColumn(Oid oTable);
+static void getOblivIndexInfo(Oid foreigntableid, OblivIndexInfo *indexInfo);
+static bool isPushableClause(Expr *clause, Index relid, OblivIndexInfo *indexInfo);
+static List *getOrderedPathKeys(PlannerInfo *root, RelOptInfo *baserel, OblivIndexInfo *indexInfo);
+static bool isJoinKeyClause(RestrictInfo *rinfo, RelOptInfo *baserel, OblivIndexInfo *indexInfo);
+static bool isMultiKeyClause(Expr *clause, Index relid, OblivIndexInfo *indexInfo);
+static bool isEqualityKeyClause(Expr *clause, Index relid, OblivIndexInfo *indexInfo);
+static bool enclaveEnforcesClauses(RelOptInfo *baserel, OblivIndexInfo *indexInfo);
+static void classifyScan(RelOptInfo *baserel, OblivIndexInfo *indexInfo, OblivRelInfo *relInfo);
+static bool ecMemberMatchesIndexedColumn(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec,
+										 EquivalenceMember *em, void *arg);
 
 static TConfig transverse_tree(Oid indexOID, bool load);
 
@@ -244,9 +528,34 @@ static char* get_nextterm(void);
 static void set_nterm(char* term);
 
 static void foreignInsert(HeapTuple tuple, Relation rel); 
+static void fetchTupleBatch(OblivScanState *fsstate);
+static int	getStashHighWater(bool reset);
+static void getScanKey(Datum value, char **key, int *keySize);
+static OblivScanKey *makeScanKey(ForeignScanState *node, OblivScanState *fsstate, OpExpr *clause, AttrNumber indexedColumn);
+static OblivScanKey *makeArrayScanKey(ForeignScanState *node, ScalarArrayOpExpr *clause, OblivTableCacheEntry *oTable);
+static void setMultiKeys(OblivScanState *fsstate, OblivScanKey *key, Datum value);
+static int	compareMultiKeys(const void *a, const void *b, void *arg);
+static void addScanBound(OblivScanState *fsstate, OblivScanBounds *bounds, OblivScanKey *key, Datum value);
+static void computeScanKeys(ForeignScanState *node, OblivScanState *fsstate);
 static void load_tuples_heap(Oid toid);
+static void checkTreetopGeometry(int typeOp);
 
 
+/*
+ * The treetop cache assumes the heap-order layout of the Path ORAM trees.
+ * The blocks of a Forest ORAM are spread over several trees, so its top
+ * levels are not the first blocks of the file.
+ */
+static void
+checkTreetopGeometry(int typeOp)
+{
+	if (typeOp == FOREST && oblivTreetopLevels > 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("the treetop cache does not support Forest ORAM"),
+				 errhint("Set oblivpg_fdw.treetop_levels to 0.")));
+}
+
 Datum
 init_soe(PG_FUNCTION_ARGS)
 {
@@ -284,6 +593,8 @@ init_soe(PG_FUNCTION_ARGS)
     pfree(initialTerm);
 #endif
 
+	checkTreetopGeometry(PG_GETARG_UINT32(0));
+
 	type_op = PG_GETARG_UINT32(0);
 	ftw_oid = PG_GETARG_OID(1);
 	opmode = PG_GETARG_UINT32(2);
@@ -332,6 +643,7 @@ init_soe(PG_FUNCTION_ARGS)
 		if (type_op == DYNAMIC)
 		{
 			hashFunctionOID = mirrorIndexTable->rd_support[0];
+			TRACE_OBLIVPG_INIT_SOE_START(ftw_oid, oStatus.tableNBlocks, oStatus.indexNBlocks);
 #ifndef UNSAFE
 			status = initSOE(enclave_id,
 							 mirrorTableRelationName,
@@ -362,10 +674,12 @@ init_soe(PG_FUNCTION_ARGS)
 					(char *) &attrDesc,
 					attrDescLength);
 #endif
+			TRACE_OBLIVPG_INIT_SOE_DONE(ftw_oid, status);
 		}
 		else if (type_op == FOREST)
 		{
             elog(DEBUG1, "Initializing FSOE for table with %d bocks", oStatus.tableNBlocks);
+			TRACE_OBLIVPG_INIT_FSOE_START(ftw_oid, oStatus.tableNBlocks);
 
 #ifndef UNSAFE
 			status = initFSOE(enclave_id,
@@ -392,6 +706,7 @@ init_soe(PG_FUNCTION_ARGS)
 					 attrDescLength);
             
 #endif
+			TRACE_OBLIVPG_INIT_FSOE_DONE(ftw_oid, status);
         pfree(config);
 		}
 		else
@@ -405,6 +720,9 @@ init_soe(PG_FUNCTION_ARGS)
 			elog(ERROR, "SOE initialization failed %d ", status);
 		}
 
+		soeTableOid = ftw_oid;
+		soeMirrorOid = oStatus.relTableMirrorId;
+
 		heap_close(mirrorHeapTable, NoLock);
 		index_close(mirrorIndexTable, NoLock);
 		heap_close(oblivMappingRel, RowShareLock);
@@ -466,6 +784,7 @@ transverse_tree(Oid indexOID, bool load)
 	unsigned int level_offset = 0;
 	unsigned int nblocks_level_next = 0;
 	TConfig		result;
+	uint32		savedWait;
 
 	result = (TConfig) palloc(sizeof(struct TreeConfig));
 	result->fanouts = (int *) palloc(sizeof(int) * DTHeight);
@@ -602,11 +921,15 @@ transverse_tree(Oid indexOID, bool load)
 		{
 			//elog(DEBUG1, "Loading block %d at level %d", level_offset, max_height);
             /* Invoke SOE function to store tree block */
+			savedWait = oblivWaitStart(OBLIV_WAIT_ECALL);
+			TRACE_OBLIVPG_ADD_INDEX_BLOCK_START(level_offset, max_height);
             #ifdef UNSAFE
 			    addIndexBlock(page, BLCKSZ, level_offset, max_height);
             #else
                 addIndexBlock(enclave_id, page, BLCKSZ, level_offset, max_height);
             #endif
+			TRACE_OBLIVPG_ADD_INDEX_BLOCK_DONE(level_offset, max_height);
+			oblivWaitEnd(savedWait);
 		}
 
 		if (P_ISROOT(opaque))
@@ -738,6 +1061,7 @@ load_blocks_heap(Oid toid)
 	Buffer		buffer;
 	Page		page;
     int*        r_blkno;
+	uint32		savedWait;
 
 	rel = heap_open(toid, NoLock);
 	npages = RelationGetNumberOfBlocks(rel);
@@ -764,11 +1088,15 @@ load_blocks_heap(Oid toid)
             }
             r_blkno = (int*) PageGetSpecialPointer(page);
             *r_blkno = blkno;
+			savedWait = oblivWaitStart(OBLIV_WAIT_ECALL);
+			TRACE_OBLIVPG_ADD_HEAP_BLOCK_START(blkno);
             #ifdef UNSAFE
 			    addHeapBlock(page, BLCKSZ, blkno);
             #else
                 addHeapBlock(enclave_id, page, BLCKSZ, blkno);
             #endif
+			TRACE_OBLIVPG_ADD_HEAP_BLOCK_DONE(blkno);
+			oblivWaitEnd(savedWait);
 		}
 		else
 		{
@@ -821,16 +1149,273 @@ close_enclave(PG_FUNCTION_ARGS)
 		PG_RETURN_INT32(status);
 	}
 
+	closeOblivStatus();
+	soeTableOid = InvalidOid;
 	PG_RETURN_INT32(status);
 #else
 	closeSoe();
+	closeOblivStatus();
+	soeTableOid = InvalidOid;
 	PG_RETURN_INT32(0);
 #endif
-	//closeOblivStatus();
 	//elog(DEBUG1, "Enclave destroyed");
 
 }
 
+/*
+ * Makes the ORAM block writes durable. The storage backends that bypass
+ * shared buffers are not covered by the database checkpoints, so this
+ * function should be called together with CHECKPOINT.
+ */
+Datum
+obliv_sync(PG_FUNCTION_ARGS)
+{
+	syncOblivFiles();
+	PG_RETURN_VOID();
+}
+
+/*
+ * Stores the ORAM state of the enclave (position map, stash and tree
+ * metadata) sealed in a file next to the ORAM relations. After a restart,
+ * obliv_restore resumes from this state and the existing ORAM files instead
+ * of running init_soe and load_blocks again. The checkpoint is removed by
+ * the next access to the ORAM, so it should be taken once the table is no
+ * longer used, for instance before stopping the server.
+ */
+Datum
+obliv_checkpoint(PG_FUNCTION_ARGS)
+{
+	Oid			ftw_oid = PG_GETARG_OID(0);
+	OblivStateHeader header;
+	unsigned int sealedSize;
+	char	   *sealed;
+	int			result;
+
+#ifndef UNSAFE
+	sgx_status_t status;
+#endif
+
+	if (soeTableOid != ftw_oid)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("SOE is not initialized for table %u", ftw_oid)));
+	}
+
+	/* The sealed state must not refer to blocks that are not on disk. */
+	syncOblivFiles();
+
+#ifndef UNSAFE
+	status = sealedStateSize(enclave_id, &sealedSize);
+	if (status != SGX_SUCCESS)
+		elog(ERROR, "SOE state size request failed %d", status);
+#else
+	sealedSize = sealedStateSize();
+#endif
+
+	sealed = (char *) palloc(sealedSize);
+
+#ifndef UNSAFE
+	status = sealState(enclave_id, &result, sealed, sealedSize);
+	if (status != SGX_SUCCESS)
+		elog(ERROR, "SOE state sealing failed %d", status);
+#else
+	result = sealState(sealed, sealedSize);
+#endif
+
+	if (result != 0)
+		elog(ERROR, "SOE could not seal its state %d", result);
+
+	header.magic = OBLIV_STATE_MAGIC;
+	header.version = OBLIV_STATE_VERSION;
+	header.ftwOid = ftw_oid;
+	header.typeOp = type_op;
+	header.opmode = opmode;
+	header.sealedSize = sealedSize;
+
+	writeOblivState(ftw_oid, soeMirrorOid, &header, sealed);
+	pfree(sealed);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Resumes the SOE of a foreign table from the state stored by
+ * obliv_checkpoint. Replaces init_soe and load_blocks after open_enclave;
+ * the ORAM files are used as they are on disk.
+ */
+Datum
+obliv_restore(PG_FUNCTION_ARGS)
+{
+	Oid			ftw_oid = PG_GETARG_OID(0);
+	Oid			mappingOid;
+	Relation	oblivMappingRel;
+	Relation	mirrorHeapTable;
+	Relation	mirrorIndexTable;
+	FdwOblivTableStatus oStatus;
+	OblivStateHeader header;
+	char	   *sealed;
+	int			result;
+
+#ifndef UNSAFE
+	sgx_status_t status;
+#endif
+
+	mappingOid = get_relname_relid(OBLIV_MAPPING_TABLE_NAME, PG_PUBLIC_NAMESPACE);
+	if (mappingOid == InvalidOid)
+		elog(ERROR, "Mapping table %s does not exist", OBLIV_MAPPING_TABLE_NAME);
+
+	oblivMappingRel = heap_open(mappingOid, RowShareLock);
+	oStatus = getOblivTableStatus(ftw_oid, oblivMappingRel);
+	heap_close(oblivMappingRel, RowShareLock);
+
+	sealed = readOblivState(ftw_oid, oStatus.relTableMirrorId, &header);
+	checkTreetopGeometry(header.typeOp);
+
+#ifdef DUMMYS
+	init_termstate();
+	set_nterm("DUMMY");
+#endif
+
+	mirrorHeapTable = heap_open(oStatus.relTableMirrorId, NoLock);
+	mirrorIndexTable = index_open(oStatus.relIndexMirrorId, NoLock);
+
+	setupOblivStatus(oStatus,
+					 RelationGetRelationName(mirrorHeapTable),
+					 RelationGetRelationName(mirrorIndexTable),
+					 mirrorIndexTable->rd_amhandler);
+
+	heap_close(mirrorHeapTable, NoLock);
+	index_close(mirrorIndexTable, NoLock);
+
+#ifndef UNSAFE
+	status = restoreState(enclave_id, &result, sealed, header.sealedSize);
+	if (status != SGX_SUCCESS)
+		elog(ERROR, "SOE state restore failed %d", status);
+#else
+	result = restoreState(sealed, header.sealedSize);
+#endif
+
+	if (result != 0)
+		elog(ERROR, "SOE could not unseal the state of table %u %d", ftw_oid, result);
+
+	pfree(sealed);
+
+	type_op = header.typeOp;
+	opmode = header.opmode;
+	soeTableOid = ftw_oid;
+	soeMirrorOid = oStatus.relTableMirrorId;
+
+	elog(DEBUG1, "Restored SOE of table %u", ftw_oid);
+
+	PG_RETURN_INT32(0);
+}
+
+/*
+ * Measures the cost of an ecall, of an ocall and of a block read of the
+ * heap ORAM file on this host, in microseconds, and sets the
+ * oblivpg_fdw.ecall_cost and oblivpg_fdw.ocall_cost settings of the session
+ * relative to oblivpg_fdw.block_cost. The values can then be stored in
+ * postgresql.conf. The ocalls are issued by the calibrate ecall, which
+ * calls the empty outCalibrate ocall nocalls times. The blocks are read
+ * from the storage backend outside the treetop cache.
+ */
+Datum
+obliv_calibrate(PG_FUNCTION_ARGS)
+{
+	int32		loops = PG_GETARG_INT32(0);
+	OblivTableCacheEntry oTable;
+	TupleDesc	tupdesc;
+	Datum		values[3];
+	bool		nulls[3];
+	instr_time	start;
+	instr_time	duration;
+	double		ecallUsec;
+	double		ocallUsec;
+	double		blockUsec;
+	char		buf[64];
+	int			i;
+	int			result;
+
+#ifndef UNSAFE
+	sgx_status_t status;
+#endif
+
+	if (soeTableOid == InvalidOid || !lookupOblivTable(soeTableOid, &oTable))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("SOE is not initialized")));
+	}
+
+	if (loops <= 0)
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of calibration loops must be positive")));
+	}
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	/* Transitions without ocalls. */
+	INSTR_TIME_SET_CURRENT(start);
+	for (i = 0; i < loops; i++)
+	{
+#ifndef UNSAFE
+		status = calibrate(enclave_id, &result, 0);
+		if (status != SGX_SUCCESS)
+			elog(ERROR, "SOE calibration failed %d", status);
+#else
+		result = calibrate(0);
+#endif
+		if (result != 0)
+			elog(ERROR, "SOE calibration failed %d", result);
+	}
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	ecallUsec = INSTR_TIME_GET_MICROSEC(duration) / loops;
+
+	/* A single transition issuing loops ocalls. */
+	INSTR_TIME_SET_CURRENT(start);
+#ifndef UNSAFE
+	status = calibrate(enclave_id, &result, loops);
+	if (status != SGX_SUCCESS)
+		elog(ERROR, "SOE calibration failed %d", status);
+#else
+	result = calibrate(loops);
+#endif
+	if (result != 0)
+		elog(ERROR, "SOE calibration failed %d", result);
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, start);
+	ocallUsec = Max(INSTR_TIME_GET_MICROSEC(duration) - ecallUsec, 0) / loops;
+
+	/* Random blocks of the heap ORAM file, as read by the ORAM paths. */
+	blockUsec = calibrateOblivStorage(OBLIV_HEAP_FILE, oTable.status.tableNBlocks, loops);
+
+	elog(DEBUG1, "Calibration: ecall %.3f us, ocall %.3f us, block %.3f us",
+		 ecallUsec, ocallUsec, blockUsec);
+
+	if (blockUsec > 0)
+	{
+		snprintf(buf, sizeof(buf), "%g", oblivBlockCost * ecallUsec / blockUsec);
+		set_config_option("oblivpg_fdw.ecall_cost", buf, PGC_USERSET, PGC_S_SESSION,
+						  GUC_ACTION_SET, true, 0, false);
+		snprintf(buf, sizeof(buf), "%g", oblivBlockCost * ocallUsec / blockUsec);
+		set_config_option("oblivpg_fdw.ocall_cost", buf, PGC_USERSET, PGC_S_SESSION,
+						  GUC_ACTION_SET, true, 0, false);
+	}
+
+	tupdesc = BlessTupleDesc(tupdesc);
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Float8GetDatum(ecallUsec);
+	values[1] = Float8GetDatum(ocallUsec);
+	values[2] = Float8GetDatum(blockUsec);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
 
 bool init_termstate(){
 
@@ -852,6 +1437,24 @@ bool init_termstate(){
     return found;
 }
 
+/*
+ * Statement trigger of the mapping table. Its rows are cached by every
+ * backend, so a change invalidates the relcache entry of the table, which
+ * drops the cached rows when the transaction commits.
+ */
+Datum
+obliv_mapping_invalidate(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "obliv_mapping_invalidate: not called by trigger manager");
+
+	CacheInvalidateRelcache(trigdata->tg_relation);
+
+	return PointerGetDatum(NULL);
+}
+
 /* Functions for updating foreign tables */
 
 
@@ -915,153 +1518,622 @@ oblivpg_fdw_validator(PG_FUNCTION_ARGS)
 
 
 
+/*
+ * Estimates the rows of the scan from the size of the mirror table, which
+ * holds the same tuples as the oblivious heap. The foreign table has no
+ * statistics, so an equality on a unique mirror index is known to return a
+ * single tuple per key and the other clauses use the default selectivities.
+ */
 static void
 obliviousGetForeignRelSize(PlannerInfo *root,
 						   RelOptInfo *baserel,
 						   Oid foreigntableid)
 {
+	OblivRelInfo *relInfo;
+	OblivIndexInfo indexInfo;
+	Relation	mirrorTable;
+	BlockNumber pages;
+	double		tuples;
+	double		allvisfrac;
+
+	relInfo = (OblivRelInfo *) palloc0(sizeof(OblivRelInfo));
+	baserel->fdw_private = (void *) relInfo;
+
+	if (!lookupOblivTable(foreigntableid, &relInfo->table) ||
+		relInfo->table.status.relTableMirrorId == InvalidOid)
+	{
+		/* not mapped yet, keep the defaults of the planner */
+		set_baserel_size_estimates(root, baserel);
+		return;
+	}
 
-	/* To complete */
-}
-
-static void
-obliviousGetForeignPaths(PlannerInfo *root,
-						 RelOptInfo *baserel,
-						 Oid foreigntableid)
-{
-	Path	   *path = NULL;
-	Cost		startup_cost = DEFAULT_FDW_STARTUP_COST;
-	Cost		total_cost = DEFAULT_OBLIV_FDW_TOTAL_COST;
-
-	path = (Path *) create_foreignscan_path(root, baserel,
-											NULL,	/* default pathtarget */
-											baserel->rows,
-											startup_cost,
-											total_cost,
-											NIL,	/* no pathkeys */
-											NULL,	/* no outer rel either */
-											NULL,	/* no extra plan */
-											NIL);	/* no fdw_private list */
+	oblivSetGeometry(relInfo);
+	getOblivIndexInfo(foreigntableid, &indexInfo);
+	classifyScan(baserel, &indexInfo, relInfo);
 
-	add_path(baserel, path);
+	mirrorTable = heap_open(relInfo->table.status.relTableMirrorId, AccessShareLock);
+	estimate_rel_size(mirrorTable, NULL, &pages, &tuples, &allvisfrac);
+	heap_close(mirrorTable, AccessShareLock);
 
+	baserel->pages = pages;
+	baserel->tuples = tuples;
 
+	set_baserel_size_estimates(root, baserel);
 
+	if (relInfo->table.indexUnique && relInfo->scanShape == OBLIV_SCAN_LOOKUP)
+		baserel->rows = 1;
+	else if (relInfo->table.indexUnique && relInfo->scanShape == OBLIV_SCAN_MULTI)
+		baserel->rows = clamp_row_est(Min(relInfo->nkeys, tuples));
 }
 
-static ForeignScan *
-obliviousGetForeignPlan(PlannerInfo *root,
-						RelOptInfo *baserel,
-						Oid foreigntableid,
-						ForeignPath *best_path,
-						List *tlist,
-						List *scan_clauses,
-						Plan *outer_plan)
+/*
+ * Sets the shape of the oblivious scan that answers the restriction clauses,
+ * following the precedence of computeScanKeys: an equality key, then the
+ * keys of an array, then the bounds of a range.
+ */
+static void
+classifyScan(RelOptInfo *baserel, OblivIndexInfo *indexInfo, OblivRelInfo *relInfo)
 {
-	ForeignScan *foreignScan = NULL;
+	bool		equality = false;
+	bool		range = false;
+	ListCell   *lc;
 
-	/*
-	 * TODO: A future implementation might iterate over the scan_clauses list
-	 * and filter any clause that is not going to be processed by the fdw. The
-	 * current prototype assumes simple queries with a single clause with the
-	 * following syntax: ... where colname op value
-	 */
-	scan_clauses = extract_actual_clauses(scan_clauses,
-										  false);	/* extract regular clauses */
+	relInfo->nkeys = 0;
 
-	foreignScan = make_foreignscan(tlist, scan_clauses, baserel->relid, NIL, NIL, NIL, NIL, NULL);
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
 
-	return foreignScan;
+		if (isEqualityKeyClause(rinfo->clause, baserel->relid, indexInfo))
+			equality = true;
+		else if (isMultiKeyClause(rinfo->clause, baserel->relid, indexInfo))
+		{
+			/* only the first array is sent to the enclave */
+			if (relInfo->nkeys == 0)
+				relInfo->nkeys = estimate_array_length((Node *) lsecond(((ScalarArrayOpExpr *) rinfo->clause)->args));
+		}
+		else if (isPushableClause(rinfo->clause, baserel->relid, indexInfo))
+			range = true;
+	}
 
+	if (equality)
+		relInfo->scanShape = OBLIV_SCAN_LOOKUP;
+	else if (relInfo->nkeys > 0)
+		relInfo->scanShape = OBLIV_SCAN_MULTI;
+	else if (range)
+		relInfo->scanShape = OBLIV_SCAN_RANGE;
+	else
+		relInfo->scanShape = OBLIV_SCAN_FULL;
 }
 
+/*
+ * Reads the indexed column of a foreign table and the btree operator family
+ * of its mirror index.
+ */
 static void
-obliviousBeginForeignScan(ForeignScanState *node, int eflags)
+getOblivIndexInfo(Oid foreigntableid, OblivIndexInfo *indexInfo)
 {
+	OblivTableCacheEntry entry;
 
-	/**On the stream execution, this function should check if the necessary resources are initiated
-	 *
-	 *  enclave
-	 *  constant rate thread
-	 *
-	 *
-	 *  For now, this code follows a similar logic as the sequential scan on the postgres code
-	 *  (nodeSeqscan.c -> ExecInitSeqScan).
-	 */
-
-	OblivScanState *fsstate;
-	Relation	oblivFDWTable;
-
-	/* Ostatus	obliv_status; */
+	memset(indexInfo, 0, sizeof(OblivIndexInfo));
 
-	FdwOblivTableStatus oStatus;
-	Relation	oblivMappingRel;
-	Oid			mappingOid;
-	List	   *scan_clauses;
+	if (!lookupOblivTable(foreigntableid, &entry) || entry.status.relIndexMirrorId == InvalidOid)
+		return;
 
+	indexInfo->attnum = entry.indexedColumn;
+	indexInfo->relam = entry.indexAm;
+	indexInfo->opfamily = entry.indexOpfamily;
+	indexInfo->opcintype = entry.indexOpcintype;
+	indexInfo->collation = entry.indexCollation;
+}
 
-	ListCell   *l;
+/*
+ * True if the clause compares the indexed column with a constant using a
+ * btree operator of the mirror index, which the enclave answers in key
+ * order.
+ */
+static bool
+isPushableClause(Expr *clause, Index relid, OblivIndexInfo *indexInfo)
+{
+	Expr	   *leftop;
+	Expr	   *rightop;
 	Oid			opno;
-	Datum		scanValue;
-	Expr	   *clause;
-	Expr	   *leftop;			/* expr on lhs of operator */
-	Expr	   *rightop;		/* expr on rhs ... */
 
-	/* AttrNumber	varattno;*/	/* att number used in scan */
-
-	/*
-	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
-	 */
-		if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-		return;
+	if (!IsA(clause, OpExpr) || indexInfo->relam != BTREE_AM_OID)
+		return false;
 
-	oblivFDWTable = node->ss.ss_currentRelation;
+	opno = ((OpExpr *) clause)->opno;
+	leftop = (Expr *) get_leftop(clause);
+	rightop = (Expr *) get_rightop(clause);
 
-	mappingOid = get_relname_relid(OBLIV_MAPPING_TABLE_NAME, PG_PUBLIC_NAMESPACE);
+	if (leftop && IsA(leftop, RelabelType))
+		leftop = ((RelabelType *) leftop)->arg;
+	if (rightop && IsA(rightop, RelabelType))
+		rightop = ((RelabelType *) rightop)->arg;
 
-	if (mappingOid != InvalidOid)
+	if (leftop && IsA(leftop, Const))
 	{
-		/* List of qualifier that will be evaluated by the fdw. */
-		scan_clauses = ((ForeignScan *) node->ss.ps.plan)->scan.plan.qual;
+		Expr	   *tmp = leftop;
 
-		fsstate = (OblivScanState *) palloc0(sizeof(OblivScanState));
+		leftop = rightop;
+		rightop = tmp;
+		opno = get_commutator(opno);
+	}
 
-		/**
-		 * The logic to parse and obtain the necessary scan clauses values follows
-		 * the function create_indescan_plan(createplan.c) and the
-		 * ExecIndexBuildScanKeys(nodeIndexscan.c).
-		 *
-		**/
+	if (leftop == NULL || !IsA(leftop, Var) || rightop == NULL || !IsA(rightop, Const))
+		return false;
 
-		/*
-		 * For the prototype we are assuming a where clause with a single
-		 * operator.
-		 */
-		foreach(l, scan_clauses)
-		{
-			clause = lfirst(l);
-			if (IsA(clause, OpExpr))
-			{
-				/* elog(DEBUG1, "Operation expression"); */
-				opno = ((OpExpr *) clause)->opno;
-				/* opfuncid = ((OpExpr *) clause)->opfuncid; */
+	if (((Var *) leftop)->varno != relid || ((Var *) leftop)->varattno != indexInfo->attnum)
+		return false;
 
-				leftop = (Expr *) get_leftop(clause);
+	return OidIsValid(opno) && get_op_opfamily_strategy(opno, indexInfo->opfamily) != 0;
+}
 
-				if (leftop && IsA(leftop, RelabelType))
-					leftop = ((RelabelType *) leftop)->arg;
+/*
+ * True if the clause is an equality between the indexed column and an
+ * expression without variables of the relation, which is a single lookup.
+ */
+static bool
+isEqualityKeyClause(Expr *clause, Index relid, OblivIndexInfo *indexInfo)
+{
+	Expr	   *leftop;
+	Expr	   *rightop;
+	Oid			opno;
+	int			eqStrategy;
 
-				/* varattno = ((Var *) leftop)->varattno; */
+	if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2 ||
+		!OidIsValid(indexInfo->opfamily))
+		return false;
 
-				rightop = (Expr *) get_rightop(clause);
+	opno = ((OpExpr *) clause)->opno;
+	leftop = (Expr *) get_leftop(clause);
+	rightop = (Expr *) get_rightop(clause);
 
-				if (IsA(rightop, Const))
-				{
-					scanValue = ((Const *) rightop)->constvalue;
-					fsstate->searchValue = VARDATA_ANY(DatumGetBpCharPP(scanValue));
-					fsstate->searchValueSize = bpchartruelen(VARDATA_ANY(DatumGetBpCharPP(scanValue)), VARSIZE_ANY_EXHDR(DatumGetBpCharPP(scanValue)));
-				}
-				fsstate->opno = opno;
+	if (leftop && IsA(leftop, RelabelType))
+		leftop = ((RelabelType *) leftop)->arg;
+	if (rightop && IsA(rightop, RelabelType))
+		rightop = ((RelabelType *) rightop)->arg;
+
+	if (rightop && IsA(rightop, Var) && ((Var *) rightop)->varno == relid)
+	{
+		Expr	   *tmp = leftop;
+
+		leftop = rightop;
+		rightop = tmp;
+		opno = get_commutator(opno);
+	}
+
+	if (leftop == NULL || !IsA(leftop, Var) ||
+		((Var *) leftop)->varno != relid || ((Var *) leftop)->varattno != indexInfo->attnum ||
+		contain_var_clause((Node *) rightop))
+		return false;
+
+	eqStrategy = indexInfo->relam == BTREE_AM_OID ? BTEqualStrategyNumber : HTEqualStrategyNumber;
+
+	return OidIsValid(opno) && get_op_opfamily_strategy(opno, indexInfo->opfamily) == eqStrategy;
+}
+
+/*
+ * True if the clause is "indexed column = ANY (array)" or an IN list, which
+ * the enclave answers with a single multi-key lookup.
+ */
+static bool
+isMultiKeyClause(Expr *clause, Index relid, OblivIndexInfo *indexInfo)
+{
+	ScalarArrayOpExpr *saop;
+	Expr	   *leftop;
+	int			eqStrategy;
+
+	if (!IsA(clause, ScalarArrayOpExpr) || !OidIsValid(indexInfo->opfamily))
+		return false;
+
+	saop = (ScalarArrayOpExpr *) clause;
+	leftop = (Expr *) linitial(saop->args);
+
+	if (leftop && IsA(leftop, RelabelType))
+		leftop = ((RelabelType *) leftop)->arg;
+
+	if (!saop->useOr || leftop == NULL || !IsA(leftop, Var) ||
+		((Var *) leftop)->varno != relid || ((Var *) leftop)->varattno != indexInfo->attnum ||
+		contain_var_clause((Node *) lsecond(saop->args)))
+		return false;
+
+	eqStrategy = indexInfo->relam == BTREE_AM_OID ? BTEqualStrategyNumber : HTEqualStrategyNumber;
+
+	return get_op_opfamily_strategy(saop->opno, indexInfo->opfamily) == eqStrategy;
+}
+
+/*
+ * Returns the query pathkeys if they only ask for the ascending order of the
+ * indexed column, the order of the leaves of the oblivious B+tree.
+ * Otherwise, returns NIL. This follows the logic of postgres_fdw, which only
+ * advertises the pathkeys that are useful for the query.
+ */
+static List *
+getOrderedPathKeys(PlannerInfo *root, RelOptInfo *baserel, OblivIndexInfo *indexInfo)
+{
+	PathKey    *pathkey;
+	ListCell   *lc;
+
+	if (list_length(root->query_pathkeys) != 1 || indexInfo->relam != BTREE_AM_OID)
+		return NIL;
+
+	pathkey = (PathKey *) linitial(root->query_pathkeys);
+
+	if (pathkey->pk_opfamily != indexInfo->opfamily ||
+		pathkey->pk_strategy != BTLessStrategyNumber ||
+		pathkey->pk_nulls_first ||
+		pathkey->pk_eclass->ec_collation != indexInfo->collation)
+		return NIL;
+
+	foreach(lc, pathkey->pk_eclass->ec_members)
+	{
+		EquivalenceMember *em = (EquivalenceMember *) lfirst(lc);
+		Expr	   *expr = em->em_expr;
+
+		if (expr && IsA(expr, RelabelType))
+			expr = ((RelabelType *) expr)->arg;
+
+		if (IsA(expr, Var) &&
+			((Var *) expr)->varno == baserel->relid &&
+			((Var *) expr)->varattno == indexInfo->attnum)
+			return root->query_pathkeys;
+	}
+
+	return NIL;
+}
+
+/*
+ * True if the clause is an equality between the indexed column and an
+ * expression over other relations, which can be the key of a
+ * parameterized scan.
+ */
+static bool
+isJoinKeyClause(RestrictInfo *rinfo, RelOptInfo *baserel, OblivIndexInfo *indexInfo)
+{
+	Expr	   *clause = rinfo->clause;
+	Expr	   *keyop;
+	Oid			opno;
+	int			eqStrategy;
+
+	if (!IsA(clause, OpExpr) || list_length(((OpExpr *) clause)->args) != 2 ||
+		!OidIsValid(indexInfo->opfamily))
+		return false;
+
+	opno = ((OpExpr *) clause)->opno;
+
+	if (bms_equal(rinfo->left_relids, baserel->relids) &&
+		!bms_overlap(rinfo->right_relids, baserel->relids))
+	{
+		keyop = (Expr *) get_leftop(clause);
+	}
+	else if (bms_equal(rinfo->right_relids, baserel->relids) &&
+			 !bms_overlap(rinfo->left_relids, baserel->relids))
+	{
+		keyop = (Expr *) get_rightop(clause);
+		opno = get_commutator(opno);
+	}
+	else
+		return false;
+
+	if (keyop && IsA(keyop, RelabelType))
+		keyop = ((RelabelType *) keyop)->arg;
+
+	if (keyop == NULL || !IsA(keyop, Var) || ((Var *) keyop)->varattno != indexInfo->attnum)
+		return false;
+
+	eqStrategy = indexInfo->relam == BTREE_AM_OID ? BTEqualStrategyNumber : HTEqualStrategyNumber;
+
+	return OidIsValid(opno) && get_op_opfamily_strategy(opno, indexInfo->opfamily) == eqStrategy;
+}
+
+/*
+ * True if the enclave only returns the tuples that satisfy every
+ * restriction clause, so that the executor filters none of them. A bound is
+ * only sent to the enclave when its constant has the type of the index
+ * keys. The range clauses added to an equality key are satisfied by all or
+ * none of its matches. The keys of an array are only enforced when the
+ * array is the single clause, the other keys are not sent with them.
+ */
+static bool
+enclaveEnforcesClauses(RelOptInfo *baserel, OblivIndexInfo *indexInfo)
+{
+	ListCell   *lc;
+
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		if (isMultiKeyClause(rinfo->clause, baserel->relid, indexInfo))
+		{
+			if (list_length(baserel->baserestrictinfo) != 1)
+				return false;
+			continue;
+		}
+
+		if (isEqualityKeyClause(rinfo->clause, baserel->relid, indexInfo))
+			continue;
+
+		if (!isPushableClause(rinfo->clause, baserel->relid, indexInfo))
+			return false;
+
+		if (exprType(get_leftop(rinfo->clause)) != indexInfo->opcintype ||
+			exprType(get_rightop(rinfo->clause)) != indexInfo->opcintype)
+			return false;
+	}
+
+	return true;
+}
+
+static bool
+ecMemberMatchesIndexedColumn(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec,
+							 EquivalenceMember *em, void *arg)
+{
+	OblivIndexInfo *indexInfo = (OblivIndexInfo *) arg;
+	Expr	   *expr = em->em_expr;
+
+	if (expr && IsA(expr, RelabelType))
+		expr = ((RelabelType *) expr)->arg;
+
+	return IsA(expr, Var) &&
+		((Var *) expr)->varno == rel->relid &&
+		((Var *) expr)->varattno == indexInfo->attnum;
+}
+
+static void
+obliviousGetForeignPaths(PlannerInfo *root,
+						 RelOptInfo *baserel,
+						 Oid foreigntableid)
+{
+	Path	   *path = NULL;
+	OblivRelInfo *relInfo = (OblivRelInfo *) baserel->fdw_private;
+	Cost		startup_cost;
+	Cost		total_cost;
+	OblivIndexInfo indexInfo;
+	List	   *pathkeys = NIL;
+	int64		maxTuples = -1;
+	bool		pushable = false;
+	bool		multiKey = false;
+	List	   *joinClauses = NIL;
+	List	   *outerRelids = NIL;
+	ListCell   *lc;
+
+	getOblivIndexInfo(foreigntableid, &indexInfo);
+
+	foreach(lc, baserel->baserestrictinfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		if (isPushableClause(rinfo->clause, baserel->relid, &indexInfo))
+			pushable = true;
+		else if (isMultiKeyClause(rinfo->clause, baserel->relid, &indexInfo))
+			multiKey = true;
+	}
+
+	if (pushable || multiKey)
+	{
+		/* The matches of several keys are not returned in key order. */
+		if (!multiKey)
+			pathkeys = getOrderedPathKeys(root, baserel, &indexInfo);
+
+		/*
+		 * PG11 has no LIMIT information for the upper paths of an FDW, but the
+		 * planner sets limit_tuples when the LIMIT applies to the rows of the
+		 * scan. The limit can only be pushed down if this is the only relation,
+		 * the enclave returns the rows in the requested order and no returned
+		 * row is filtered by the executor.
+		 */
+		if (root->limit_tuples > 0 &&
+			bms_membership(root->all_baserels) == BMS_SINGLETON &&
+			(root->query_pathkeys == NIL ||
+			 pathkeys_contained_in(root->query_pathkeys, pathkeys)) &&
+			enclaveEnforcesClauses(baserel, &indexInfo))
+			maxTuples = (int64) root->limit_tuples;
+	}
+
+	oblivEstimateCosts(baserel, relInfo, relInfo->scanShape, relInfo->nkeys,
+					   baserel->rows, &startup_cost, &total_cost);
+
+	path = (Path *) create_foreignscan_path(root, baserel,
+											NULL,	/* default pathtarget */
+											baserel->rows,
+											startup_cost,
+											total_cost,
+											pathkeys,
+											NULL,	/* no outer rel either */
+											NULL,	/* no extra plan */
+											list_make1(makeConst(INT8OID, -1, InvalidOid,
+																 sizeof(int64),
+																 Int64GetDatum(maxTuples),
+																 false, FLOAT8PASSBYVAL)));
+
+	add_path(baserel, path);
+
+	/*
+	 * Parameterized paths for the join clauses on the indexed column. A
+	 * nested loop then feeds the key of every outer row to a single
+	 * oblivious lookup through a rescan of the foreign scan. Equalities
+	 * between relations are usually merged into equivalence classes, so the
+	 * clauses are also generated from them, as done by postgres_fdw.
+	 */
+	foreach(lc, baserel->joininfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		if (isJoinKeyClause(rinfo, baserel, &indexInfo))
+			joinClauses = lappend(joinClauses, rinfo);
+	}
+
+	if (baserel->has_eclass_joins && indexInfo.attnum != 0)
+	{
+		List	   *ecClauses;
+
+		ecClauses = generate_implied_equalities_for_column(root, baserel,
+														   ecMemberMatchesIndexedColumn,
+														   (void *) &indexInfo,
+														   baserel->lateral_referencers);
+		foreach(lc, ecClauses)
+		{
+			RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+			if (isJoinKeyClause(rinfo, baserel, &indexInfo))
+				joinClauses = lappend(joinClauses, rinfo);
+		}
+	}
+
+	foreach(lc, joinClauses)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		Relids		requiredOuter;
+		ParamPathInfo *paramInfo;
+		double		rows;
+		ListCell   *olc;
+		bool		found = false;
+
+		requiredOuter = bms_union(rinfo->clause_relids, baserel->lateral_relids);
+		requiredOuter = bms_del_member(requiredOuter, baserel->relid);
+		if (bms_is_empty(requiredOuter))
+			continue;
+
+		foreach(olc, outerRelids)
+		{
+			if (bms_equal((Relids) lfirst(olc), requiredOuter))
+				found = true;
+		}
+		if (found)
+			continue;
+		outerRelids = lappend(outerRelids, requiredOuter);
+
+		paramInfo = get_baserel_parampathinfo(root, baserel, requiredOuter);
+
+		/* every rescan is a single lookup */
+		rows = relInfo->table.indexUnique ? 1 : paramInfo->ppi_rows;
+		oblivEstimateCosts(baserel, relInfo, OBLIV_SCAN_LOOKUP, 1,
+						   rows, &startup_cost, &total_cost);
+
+		path = (Path *) create_foreignscan_path(root, baserel,
+												NULL,	/* default pathtarget */
+												rows,
+												startup_cost,
+												total_cost,
+												NIL,	/* no pathkeys */
+												requiredOuter,
+												NULL,	/* no extra plan */
+												list_make1(makeConst(INT8OID, -1, InvalidOid,
+																	 sizeof(int64),
+																	 Int64GetDatum(-1),
+																	 false, FLOAT8PASSBYVAL)));
+
+		add_path(baserel, path);
+	}
+}
+
+static ForeignScan *
+obliviousGetForeignPlan(PlannerInfo *root,
+						RelOptInfo *baserel,
+						Oid foreigntableid,
+						ForeignPath *best_path,
+						List *tlist,
+						List *scan_clauses,
+						Plan *outer_plan)
+{
+	ForeignScan *foreignScan = NULL;
+
+	/*
+	 * TODO: A future implementation might iterate over the scan_clauses list
+	 * and filter any clause that is not going to be processed by the fdw. The
+	 * current prototype assumes simple queries with a single clause with the
+	 * following syntax: ... where colname op value
+	 */
+	scan_clauses = extract_actual_clauses(scan_clauses,
+										  false);	/* extract regular clauses */
+
+	foreignScan = make_foreignscan(tlist, scan_clauses, baserel->relid, NIL,
+								   best_path->fdw_private, NIL, NIL, NULL);
+
+	return foreignScan;
+
+}
+
+static void
+obliviousBeginForeignScan(ForeignScanState *node, int eflags)
+{
+
+	/**On the stream execution, this function should check if the necessary resources are initiated
+	 *
+	 *  enclave
+	 *  constant rate thread
+	 *
+	 *
+	 *  For now, this code follows a similar logic as the sequential scan on the postgres code
+	 *  (nodeSeqscan.c -> ExecInitSeqScan).
+	 */
+
+	OblivScanState *fsstate;
+	Relation	oblivFDWTable;
+
+	/* Ostatus	obliv_status; */
+
+	OblivTableCacheEntry oTable;
+	List	   *scan_clauses;
+
+
+	ListCell   *l;
+	Expr	   *clause;
+	OblivScanKey *key;
+
+	/*
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
+	 */
+		if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	oblivFDWTable = node->ss.ss_currentRelation;
+
+	/*
+	 * The mapping table row and the mirror index information are cached by
+	 * lookupOblivTable, so the scan setup does not read any catalog.
+	 */
+	if (lookupOblivTable(oblivFDWTable->rd_id, &oTable))
+	{
+		/* List of qualifier that will be evaluated by the fdw. */
+		scan_clauses = ((ForeignScan *) node->ss.ps.plan)->scan.plan.qual;
+
+		fsstate = (OblivScanState *) palloc0(sizeof(OblivScanState));
+		fsstate->ftwOid = oblivFDWTable->rd_id;
+
+		/*
+		 * The operators are classified with the btree strategies of the
+		 * operator family of the mirror index. A hash index only supports
+		 * point lookups.
+		 */
+		if (oTable.indexAm == BTREE_AM_OID)
+		{
+			fsstate->opfamily = oTable.indexOpfamily;
+			fsstate->opcintype = oTable.indexOpcintype;
+			fmgr_info(oTable.indexCmpProc, &fsstate->cmpProc);
+		}
+
+		/*
+		 * The clauses on the indexed column become the scan keys. Their
+		 * values can be parameters of a prepared statement or keys of the
+		 * outer side of a nested loop, so they are evaluated when the scan
+		 * starts. All the clauses are still checked on the returned tuples.
+		 */
+		foreach(l, scan_clauses)
+		{
+			clause = lfirst(l);
+			if (IsA(clause, OpExpr))
+			{
+				key = makeScanKey(node, fsstate, (OpExpr *) clause, oTable.indexedColumn);
+				if (key != NULL)
+					fsstate->scanKeys = lappend(fsstate->scanKeys, key);
+			}
+			else if (IsA(clause, ScalarArrayOpExpr))
+			{
+				key = makeArrayScanKey(node, (ScalarArrayOpExpr *) clause, &oTable);
+				if (key != NULL)
+					fsstate->scanKeys = lappend(fsstate->scanKeys, key);
 			}
 			else
 			{
@@ -1070,71 +2142,556 @@ obliviousBeginForeignScan(ForeignScanState *node, int eflags)
 			}
 		}
 
+		fsstate->keyContext = AllocSetContextCreate(CurrentMemoryContext,
+													"oblivpg_fdw scan keys",
+													ALLOCSET_SMALL_SIZES);
+		fsstate->keysReady = false;
 
-		oblivMappingRel = heap_open(mappingOid, AccessShareLock);
-		oStatus = getOblivTableStatus(oblivFDWTable->rd_id, oblivMappingRel);
-		oStatus.tableRelFileNode = oblivFDWTable->rd_id;
-		validateIndexStatus(oStatus);
+		validateIndexStatus(oTable.status);
 
 		/* elog(DEBUG1, "initializing fsstate %d", obliv_status); */
 
 		node->fdw_state = (void *) fsstate;
-		fsstate->tupleHeader = (HeapTupleHeader) palloc0(MAX_TUPLE_SIZE);
-		//memset(fsstate->tupleHeader, 0, MAX_TUPLE_SIZE);
-		fsstate->mirrorTable = heap_open(oStatus.relTableMirrorId, AccessShareLock);
+		fsstate->tuples = (HeapTupleData *) palloc0(sizeof(HeapTupleData) * OBLIV_TUPLE_BATCH_SIZE);
+		fsstate->tupleHeaders = (char *) palloc0(MAX_TUPLE_SIZE * OBLIV_TUPLE_BATCH_SIZE);
+		fsstate->numTuples = 0;
+		fsstate->nextTuple = 0;
+		fsstate->eof = false;
+		fsstate->maxTuples = DatumGetInt64(((Const *) linitial(((ForeignScan *) node->ss.ps.plan)->fdw_private))->constvalue);
+		fsstate->returnedTuples = 0;
+		fsstate->mirrorTable = heap_open(oTable.status.relTableMirrorId, AccessShareLock);
 		fsstate->tableTupdesc = RelationGetDescr(fsstate->mirrorTable);
-		heap_close(oblivMappingRel, AccessShareLock);
+
+		fsstate->instrumented = node->ss.ps.instrument != NULL;
 	}
 }
 
-static TupleTableSlot *
-obliviousIterateForeignScan(ForeignScanState *node)
+/*
+ * Search key of a value of the indexed column. The prototype assumes
+ * searches over char columns.
+ */
+static void
+getScanKey(Datum value, char **key, int *keySize)
+{
+	BpChar	   *bpchar = DatumGetBpCharPP(value);
+
+	*key = VARDATA_ANY(bpchar);
+	*keySize = bpchartruelen(VARDATA_ANY(bpchar), VARSIZE_ANY_EXHDR(bpchar));
+}
+
+/*
+ * Builds the scan key of a clause "column op value" or "value op column" on
+ * the indexed column. Returns NULL for the clauses on other columns, which
+ * are only checked on the returned tuples.
+ *
+ * The logic to parse and obtain the necessary scan clauses values follows
+ * the function create_indescan_plan(createplan.c) and the
+ * ExecIndexBuildScanKeys(nodeIndexscan.c).
+ */
+static OblivScanKey *
+makeScanKey(ForeignScanState *node, OblivScanState *fsstate, OpExpr *clause, AttrNumber indexedColumn)
+{
+	Index		scanrelid = ((Scan *) node->ss.ps.plan)->scanrelid;
+	Oid			opno = clause->opno;
+	Expr	   *leftop;			/* expr on lhs of operator */
+	Expr	   *rightop;		/* expr on rhs ... */
+	OblivScanKey *key;
+
+	leftop = (Expr *) get_leftop((Expr *) clause);
+	rightop = (Expr *) get_rightop((Expr *) clause);
+
+	if (leftop && IsA(leftop, RelabelType))
+		leftop = ((RelabelType *) leftop)->arg;
+	if (rightop && IsA(rightop, RelabelType))
+		rightop = ((RelabelType *) rightop)->arg;
+
+	/* value op column is scanned as column op' value */
+	if (rightop && IsA(rightop, Var) && ((Var *) rightop)->varno == scanrelid)
+	{
+		Expr	   *tmp = leftop;
+
+		leftop = rightop;
+		rightop = tmp;
+		opno = get_commutator(opno);
+		if (opno == InvalidOid)
+			elog(ERROR, "Expression not supported");
+	}
+
+	if (leftop == NULL || !IsA(leftop, Var) || ((Var *) leftop)->varattno != indexedColumn)
+		return NULL;
+
+	/* The value must be known before the scan starts. */
+	if (rightop == NULL || contain_var_clause((Node *) rightop))
+		return NULL;
+
+	key = (OblivScanKey *) palloc0(sizeof(OblivScanKey));
+	key->opno = opno;
+
+	/* Bounds of another type are not comparable with the index function. */
+	if (OidIsValid(fsstate->opfamily) && exprType((Node *) rightop) == fsstate->opcintype)
+		key->strategy = get_op_opfamily_strategy(opno, fsstate->opfamily);
+
+	key->collation = clause->inputcollid;
+	key->valueExpr = ExecInitExpr(rightop, (PlanState *) node);
+
+	return key;
+}
+
+/*
+ * Builds the scan key of a clause "column = ANY (array)", which is also the
+ * form of an IN list. Returns NULL for the clauses that are not a set of
+ * equality keys on the indexed column.
+ */
+static OblivScanKey *
+makeArrayScanKey(ForeignScanState *node, ScalarArrayOpExpr *clause, OblivTableCacheEntry *oTable)
+{
+	Index		scanrelid = ((Scan *) node->ss.ps.plan)->scanrelid;
+	Expr	   *leftop;
+	Expr	   *rightop;
+	OblivScanKey *key;
+	int			eqStrategy;
+
+	leftop = (Expr *) linitial(clause->args);
+	rightop = (Expr *) lsecond(clause->args);
+
+	if (leftop && IsA(leftop, RelabelType))
+		leftop = ((RelabelType *) leftop)->arg;
+
+	if (!clause->useOr || leftop == NULL || !IsA(leftop, Var) ||
+		((Var *) leftop)->varno != scanrelid || ((Var *) leftop)->varattno != oTable->indexedColumn ||
+		contain_var_clause((Node *) rightop))
+		return NULL;
+
+	eqStrategy = oTable->indexAm == BTREE_AM_OID ? BTEqualStrategyNumber : HTEqualStrategyNumber;
+	if (get_op_opfamily_strategy(clause->opno, oTable->indexOpfamily) != eqStrategy)
+		return NULL;
+
+	key = (OblivScanKey *) palloc0(sizeof(OblivScanKey));
+	key->opno = clause->opno;
+	key->strategy = BTEqualStrategyNumber;
+	key->collation = clause->inputcollid;
+	key->isArray = true;
+	key->elemType = get_element_type(exprType((Node *) rightop));
+	key->valueExpr = ExecInitExpr(rightop, (PlanState *) node);
+
+	return key;
+}
+
+static int
+compareMultiKeys(const void *a, const void *b, void *arg)
+{
+	OblivMultiKeySort *sort = (OblivMultiKeySort *) arg;
+	Datum		left = *(const Datum *) a;
+	Datum		right = *(const Datum *) b;
+	char	   *leftKey;
+	char	   *rightKey;
+	int			leftSize;
+	int			rightSize;
+	int			cmp;
+
+	if (sort->cmpProc != NULL)
+		return DatumGetInt32(FunctionCall2Coll(sort->cmpProc, sort->collation, left, right));
+
+	getScanKey(left, &leftKey, &leftSize);
+	getScanKey(right, &rightKey, &rightSize);
+
+	cmp = memcmp(leftKey, rightKey, Min(leftSize, rightSize));
+	if (cmp != 0)
+		return cmp;
+	return (leftSize > rightSize) - (leftSize < rightSize);
+}
+
+/*
+ * Concatenates the keys of an array for a multi-key lookup. Null elements
+ * match no tuple and are skipped. The keys are sorted and the duplicates
+ * removed, so that the enclave looks up every key once and returns its
+ * matches once.
+ */
+static void
+setMultiKeys(OblivScanState *fsstate, OblivScanKey *key, Datum value)
+{
+	ArrayType  *array = DatumGetArrayTypeP(value);
+	OblivMultiKeySort sort;
+	int16		elmlen;
+	bool		elmbyval;
+	char		elmalign;
+	Datum	   *elems;
+	bool	   *nulls;
+	int			nelems;
+	int			nkeys = 0;
+	int			i;
+	char	   *elemKey;
+	int			elemKeySize;
+	int			offset = 0;
+
+	get_typlenbyvalalign(key->elemType, &elmlen, &elmbyval, &elmalign);
+	deconstruct_array(array, key->elemType, elmlen, elmbyval, elmalign,
+					  &elems, &nulls, &nelems);
+
+	for (i = 0; i < nelems; i++)
+	{
+		if (!nulls[i])
+			elems[nkeys++] = elems[i];
+	}
+
+	/* Keys of another type are not comparable with the index function. */
+	sort.cmpProc = OidIsValid(fsstate->cmpProc.fn_oid) && key->elemType == fsstate->opcintype ?
+		&fsstate->cmpProc : NULL;
+	sort.collation = key->collation;
+
+	if (nkeys > 1)
+	{
+		int			last = 0;
+
+		qsort_arg(elems, nkeys, sizeof(Datum), compareMultiKeys, &sort);
+		for (i = 1; i < nkeys; i++)
+		{
+			if (compareMultiKeys(&elems[last], &elems[i], &sort) != 0)
+				elems[++last] = elems[i];
+		}
+		nkeys = last + 1;
+	}
+
+	fsstate->multiKeyLengths = (int *) palloc(sizeof(int) * Max(nkeys, 1));
+	fsstate->numMultiKeys = nkeys;
+
+	for (i = 0; i < nkeys; i++)
+	{
+		getScanKey(elems[i], &elemKey, &elemKeySize);
+		fsstate->multiKeyLengths[i] = elemKeySize;
+		offset += elemKeySize;
+	}
+
+	fsstate->multiKeys = (char *) palloc(Max(offset, 1));
+	fsstate->multiKeysSize = offset;
+
+	offset = 0;
+	for (i = 0; i < nkeys; i++)
+	{
+		getScanKey(elems[i], &elemKey, &elemKeySize);
+		memcpy(fsstate->multiKeys + offset, elemKey, elemKeySize);
+		offset += elemKeySize;
+	}
+
+	fsstate->opno = key->opno;
+	fsstate->isMulti = true;
+}
+
+/*
+ * Adds the value of a scan key to the search key or to the bounds of the
+ * scan. The comparison function of the index keeps the tightest bound when
+ * a side is bounded by several keys.
+ */
+static void
+addScanBound(OblivScanState *fsstate, OblivScanBounds *bounds, OblivScanKey *key, Datum value)
+{
+	bool		inclusive;
+	int			cmp;
+
+	switch (key->strategy)
+	{
+		case BTGreaterStrategyNumber:
+		case BTGreaterEqualStrategyNumber:
+			inclusive = key->strategy == BTGreaterEqualStrategyNumber;
+			if (bounds->hasLow)
+			{
+				cmp = DatumGetInt32(FunctionCall2Coll(&fsstate->cmpProc, key->collation,
+													  value, bounds->low));
+				if (cmp < 0 || (cmp == 0 && inclusive))
+					break;
+			}
+			bounds->hasLow = true;
+			bounds->lowInclusive = inclusive;
+			bounds->low = value;
+			break;
+
+		case BTLessStrategyNumber:
+		case BTLessEqualStrategyNumber:
+			inclusive = key->strategy == BTLessEqualStrategyNumber;
+			if (bounds->hasHigh)
+			{
+				cmp = DatumGetInt32(FunctionCall2Coll(&fsstate->cmpProc, key->collation,
+													  value, bounds->high));
+				if (cmp > 0 || (cmp == 0 && inclusive))
+					break;
+			}
+			bounds->hasHigh = true;
+			bounds->highInclusive = inclusive;
+			bounds->high = value;
+			break;
+
+		default:
+			/* Equality and operators handled by the enclave as before. */
+			getScanKey(value, &fsstate->searchValue, &fsstate->searchValueSize);
+			fsstate->opno = key->opno;
+			bounds->hasEquality = true;
+			break;
+	}
+}
+
+/*
+ * Evaluates the scan keys when the scan starts or restarts. An equality key
+ * is a point lookup, otherwise the bounds of the keys define a range scan.
+ */
+static void
+computeScanKeys(ForeignScanState *node, OblivScanState *fsstate)
+{
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	MemoryContext oldcxt;
+	OblivScanBounds bounds;
+	OblivScanKey *key;
+	ListCell   *l;
+	Datum		value;
+	bool		isnull;
+
+	MemoryContextReset(fsstate->keyContext);
+	memset(&bounds, 0, sizeof(OblivScanBounds));
+	fsstate->searchValue = NULL;
+	fsstate->searchValueSize = 0;
+	fsstate->isRange = false;
+	fsstate->rangeFlags = 0;
+	fsstate->isMulti = false;
+	fsstate->keysReady = true;
+	fsstate->newScan = true;
+
+	foreach(l, fsstate->scanKeys)
+	{
+		key = (OblivScanKey *) lfirst(l);
+
+		oldcxt = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+		value = ExecEvalExpr(key->valueExpr, econtext, &isnull);
+		MemoryContextSwitchTo(oldcxt);
+
+		/* The operators are strict, no tuple matches a null key. */
+		if (isnull)
+		{
+			fsstate->eof = true;
+			return;
+		}
+
+		oldcxt = MemoryContextSwitchTo(fsstate->keyContext);
+		if (!key->isArray)
+			addScanBound(fsstate, &bounds, key, datumCopy(value, false, -1));
+		else if (!fsstate->isMulti)
+			setMultiKeys(fsstate, key, value);
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	/* A single key is cheaper than the multi-key lookup. */
+	if (bounds.hasEquality)
+		fsstate->isMulti = false;
+
+	if (fsstate->isMulti && fsstate->numMultiKeys == 0)
+	{
+		fsstate->eof = true;
+		return;
+	}
+
+	if (!bounds.hasEquality && !fsstate->isMulti && (bounds.hasLow || bounds.hasHigh))
+	{
+		oldcxt = MemoryContextSwitchTo(fsstate->keyContext);
+
+		fsstate->isRange = true;
+		if (bounds.hasLow)
+		{
+			getScanKey(bounds.low, &fsstate->lowKey, &fsstate->lowKeySize);
+			fsstate->rangeFlags |= OBLIV_RANGE_LOW;
+			if (bounds.lowInclusive)
+				fsstate->rangeFlags |= OBLIV_RANGE_LOW_INCLUSIVE;
+		}
+		if (bounds.hasHigh)
+		{
+			getScanKey(bounds.high, &fsstate->highKey, &fsstate->highKeySize);
+			fsstate->rangeFlags |= OBLIV_RANGE_HIGH;
+			if (bounds.highInclusive)
+				fsstate->rangeFlags |= OBLIV_RANGE_HIGH_INCLUSIVE;
+		}
+
+		MemoryContextSwitchTo(oldcxt);
+	}
+}
+
+/*
+ * Fetches the next batch of tuples from the enclave. A batch with less than
+ * the requested tuples is the last one.
+ */
+static void
+fetchTupleBatch(OblivScanState *fsstate)
 {
 	int			len;
 	char	   *key;
-	int			rowFound;
-   
-	/* int indexedColumn; */
-	OblivScanState *fsstate;
-	TupleTableSlot *tupleSlot;
-
-	fsstate = (OblivScanState *) node->fdw_state;
-	tupleSlot = node->ss.ss_ScanTupleSlot;
+	int			capacity = OBLIV_TUPLE_BATCH_SIZE;
+	int			numTuples;
+	int			i;
+	OblivUsage	usageStart;
+	instr_time	ecallStart;
+	int64		bytes;
 
-	/* elog(DEBUG1, "Going to read tuple in function getTuple"); */
 #ifdef DUMMYS
-     key = get_nextterm();
-     len = strlen(key);
-     fsstate->opno = 1054; // for now lets test equals
-     //fsstate->opno = 1061;
+	key = get_nextterm();
+	len = strlen(key);
+	fsstate->opno = 1054;		/* for now lets test equals */
+	/* Every row is searched with a new term. */
+	capacity = 1;
 #else
-    key = fsstate->searchValue;
+	key = fsstate->searchValue;
 	len = fsstate->searchValueSize;
 #endif
 
-    
+	if (fsstate->maxTuples >= 0)
+		capacity = (int) Min(capacity, fsstate->maxTuples - fsstate->returnedTuples);
+
+	bytes = (int64) (sizeof(HeapTupleData) + MAX_TUPLE_SIZE) * capacity;
+
+	/*
+	 * The stash high-water mark of the enclave is reset before the ecall,
+	 * so that it only covers the accesses of this scan.
+	 */
+	if (fsstate->instrumented)
+	{
+		getStashHighWater(true);
+		usageStart = oblivUsage;
+	}
+
+	/* An error in the enclave must not leave the timing on. */
+	PG_TRY();
+	{
+		oblivTrackTiming = fsstate->instrumented;
+		oblivEcallStart(&ecallStart, fsstate->ftwOid);
+		TRACE_OBLIVPG_GETTUPLE_START(fsstate->ftwOid, capacity);
+		if (fsstate->newScan)
+			oblivStatsLookup(fsstate->isMulti ? fsstate->numMultiKeys : 1);
 
+		if (fsstate->isMulti)
+		{
+			/* The k lookups share the transition and the result buffer. */
+			bytes += fsstate->multiKeysSize + sizeof(int) * fsstate->numMultiKeys;
 #ifdef UNSAFE
-		rowFound = getTuple(opmode, fsstate->opno, key, len, (char *) &(fsstate->tuple), sizeof(HeapTupleData), (char *) fsstate->tupleHeader, MAX_TUPLE_SIZE);
+			numTuples = getTupleMulti(opmode, fsstate->newScan, fsstate->opno,
+									  fsstate->multiKeys, fsstate->multiKeysSize,
+									  (char *) fsstate->multiKeyLengths, sizeof(int) * fsstate->numMultiKeys,
+									  fsstate->numMultiKeys,
+									  (char *) fsstate->tuples, sizeof(HeapTupleData) * capacity,
+									  fsstate->tupleHeaders, MAX_TUPLE_SIZE * capacity,
+									  capacity);
 #else
-		getTuple(enclave_id, &rowFound, opmode, fsstate->opno, key, len, (char *) &(fsstate->tuple), sizeof(HeapTupleData), (char *) fsstate->tupleHeader, MAX_TUPLE_SIZE);
+			getTupleMulti(enclave_id, &numTuples, opmode, fsstate->newScan, fsstate->opno,
+						  fsstate->multiKeys, fsstate->multiKeysSize,
+						  (char *) fsstate->multiKeyLengths, sizeof(int) * fsstate->numMultiKeys,
+						  fsstate->numMultiKeys,
+						  (char *) fsstate->tuples, sizeof(HeapTupleData) * capacity,
+						  fsstate->tupleHeaders, MAX_TUPLE_SIZE * capacity,
+						  capacity);
 #endif
+		}
+		else if (fsstate->isRange)
+		{
+			/* Bounded walk over the leaf chain of the oblivious B+tree. */
+			bytes += fsstate->lowKeySize + fsstate->highKeySize;
+#ifdef UNSAFE
+			numTuples = getTupleRange(opmode, fsstate->newScan,
+									  fsstate->lowKey, fsstate->lowKeySize,
+									  fsstate->highKey, fsstate->highKeySize,
+									  fsstate->rangeFlags,
+									  (char *) fsstate->tuples, sizeof(HeapTupleData) * capacity,
+									  fsstate->tupleHeaders, MAX_TUPLE_SIZE * capacity,
+									  capacity);
+#else
+			getTupleRange(enclave_id, &numTuples, opmode, fsstate->newScan,
+						  fsstate->lowKey, fsstate->lowKeySize,
+						  fsstate->highKey, fsstate->highKeySize,
+						  fsstate->rangeFlags,
+						  (char *) fsstate->tuples, sizeof(HeapTupleData) * capacity,
+						  fsstate->tupleHeaders, MAX_TUPLE_SIZE * capacity,
+						  capacity);
+#endif
+		}
+		else
+		{
+			bytes += len;
+#ifdef UNSAFE
+			numTuples = getTupleBatch(opmode, fsstate->newScan, fsstate->opno, key, len,
+									  (char *) fsstate->tuples, sizeof(HeapTupleData) * capacity,
+									  fsstate->tupleHeaders, MAX_TUPLE_SIZE * capacity,
+									  capacity);
+#else
+			getTupleBatch(enclave_id, &numTuples, opmode, fsstate->newScan, fsstate->opno, key, len,
+						  (char *) fsstate->tuples, sizeof(HeapTupleData) * capacity,
+						  fsstate->tupleHeaders, MAX_TUPLE_SIZE * capacity,
+						  capacity);
+#endif
+		}
+	}
+	PG_CATCH();
+	{
+		oblivTrackTiming = false;
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	TRACE_OBLIVPG_GETTUPLE_DONE(fsstate->ftwOid, numTuples);
+	oblivEcallEnd(&ecallStart, OBLIV_STAT_ECALL_SCAN, bytes);
+	if (fsstate->instrumented)
+	{
+		oblivTrackTiming = false;
+		oblivUsageAccumDiff(&fsstate->usage, &oblivUsage, &usageStart);
+		fsstate->usage.stashHighWater = Max(fsstate->usage.stashHighWater,
+											getStashHighWater(false));
+	}
 
 #ifdef DUMMYS
-    pfree(key);
+	pfree(key);
 #endif
-	fsstate->tuple.t_data = fsstate->tupleHeader;
-	
-    if (rowFound == 0)
+
+	if (numTuples < 0 || numTuples > capacity)
+		elog(ERROR, "Enclave returned %d tuples for a batch of %d", numTuples, capacity);
+
+	fsstate->newScan = false;
+
+	/* The enclave copies the tuple headers but not their location. */
+	for (i = 0; i < numTuples; i++)
+		fsstate->tuples[i].t_data = (HeapTupleHeader) (fsstate->tupleHeaders + (i * MAX_TUPLE_SIZE));
+
+	fsstate->numTuples = numTuples;
+	fsstate->nextTuple = 0;
+	fsstate->returnedTuples += numTuples;
+	fsstate->eof = numTuples < capacity ||
+		(fsstate->maxTuples >= 0 && fsstate->returnedTuples >= fsstate->maxTuples);
+}
+
+static TupleTableSlot *
+obliviousIterateForeignScan(ForeignScanState *node)
+{
+	OblivScanState *fsstate;
+	TupleTableSlot *tupleSlot;
+
+	fsstate = (OblivScanState *) node->fdw_state;
+	tupleSlot = node->ss.ss_ScanTupleSlot;
+
+	if (!fsstate->keysReady)
 	{
-		ExecStoreTuple(&(fsstate->tuple), tupleSlot, InvalidBuffer, false);
+		oblivTraceInstant(OBLIV_TRACE_SCAN, fsstate->ftwOid);
+		computeScanKeys(node, fsstate);
 	}
-	else
+
+	/* The enclave is only called when the current batch runs dry. */
+	if (fsstate->nextTuple >= fsstate->numTuples)
 	{
-		/* Reached the end of available tuples */
-		return ExecClearTuple(tupleSlot);
+		if (fsstate->eof)
+			return ExecClearTuple(tupleSlot);
+
+		fetchTupleBatch(fsstate);
+
+		if (fsstate->numTuples == 0)
+		{
+			/* Reached the end of available tuples */
+			return ExecClearTuple(tupleSlot);
+		}
 	}
 
+	ExecStoreTuple(&(fsstate->tuples[fsstate->nextTuple++]), tupleSlot, InvalidBuffer, false);
+	oblivTraceInstant(OBLIV_TRACE_TUPLE, fsstate->ftwOid);
+
 	return tupleSlot;
 }
 
@@ -1146,24 +2703,88 @@ obliviousEndForeignScan(ForeignScanState *node)
 
 	fsstate = (OblivScanState *) node->fdw_state;
 	heap_close(fsstate->mirrorTable, AccessShareLock);
-	pfree(fsstate->tupleHeader);
+	pfree(fsstate->tuples);
+	pfree(fsstate->tupleHeaders);
+	MemoryContextDelete(fsstate->keyContext);
 	pfree(fsstate);
 }
 
 
+/*
+ * Largest number of blocks held in the stash of the enclave since the last
+ * reset. These ecalls are not counted in the usage of the scans.
+ */
+static int
+getStashHighWater(bool reset)
+{
+	int			result;
+
+#ifndef UNSAFE
+	sgx_status_t status;
+
+	status = stashHighWater(enclave_id, &result, reset ? 1 : 0);
+	if (status != SGX_SUCCESS)
+		elog(ERROR, "SOE stash high-water request failed %d", status);
+#else
+	result = stashHighWater(reset ? 1 : 0);
+#endif
+
+	return result;
+}
+
+/*
+ * With ANALYZE, shows the enclave transitions, the ORAM block I/O and the
+ * time spent in the enclave and in the block ocalls by the scan. The
+ * ocall time is part of the enclave time.
+ */
 static void
 obliviousExplainForeignScan(ForeignScanState *node,
 							ExplainState *es)
 {
-	/* To complete */
+	OblivScanState *fsstate = (OblivScanState *) node->fdw_state;
+	OblivUsage *usage;
+
+	if (!es->analyze || fsstate == NULL)
+		return;
+
+	usage = &fsstate->usage;
+
+	ExplainPropertyInteger("Oblivious Ecalls", NULL, usage->ecalls, es);
+	ExplainPropertyInteger("Oblivious Ocall Reads", NULL, usage->ocallReads, es);
+	ExplainPropertyInteger("Oblivious Ocall Writes", NULL, usage->ocallWrites, es);
+	ExplainPropertyInteger("Heap ORAM Blocks Read", NULL, usage->blocksRead[OBLIV_HEAP_FILE], es);
+	ExplainPropertyInteger("Heap ORAM Blocks Written", NULL, usage->blocksWritten[OBLIV_HEAP_FILE], es);
+	ExplainPropertyInteger("Index ORAM Blocks Read", NULL, usage->blocksRead[OBLIV_INDEX_FILE], es);
+	ExplainPropertyInteger("Index ORAM Blocks Written", NULL, usage->blocksWritten[OBLIV_INDEX_FILE], es);
+	ExplainPropertyInteger("Enclave Boundary Bytes", "kB", (usage->bytesCrossed + 1023) / 1024, es);
+	ExplainPropertyInteger("Stash High Water", NULL, usage->stashHighWater, es);
+
+	if (es->timing)
+	{
+		ExplainPropertyFloat("Enclave Time", "ms",
+							 INSTR_TIME_GET_MILLISEC(usage->enclaveTime), 3, es);
+		ExplainPropertyFloat("Ocall I/O Time", "ms",
+							 INSTR_TIME_GET_MILLISEC(usage->ioTime), 3, es);
+	}
 }
 
 
 
+/*
+ * Restarts the scan with the current values of its keys, such as the key of
+ * the next outer row of a nested loop. The scan state and the enclave are
+ * reused, the keys are evaluated again by the next iterate call.
+ */
 static void
 obliviousReScanForeignScan(ForeignScanState *node)
 {
-	/* To complete */
+	OblivScanState *fsstate = (OblivScanState *) node->fdw_state;
+
+	fsstate->keysReady = false;
+	fsstate->numTuples = 0;
+	fsstate->nextTuple = 0;
+	fsstate->eof = false;
+	fsstate->returnedTuples = 0;
 }
 
 static bool
@@ -1194,29 +2815,12 @@ obliviousBeginForeignModify(ModifyTableState *mtstate,
 int
 getindexColumn(Oid oTable)
 {
-	Oid			mappingOid;
-	FdwOblivTableStatus oStatus;
-
-	Relation	oblivMappingRel;
-	Relation	mirrorIndexTable;
+	OblivTableCacheEntry entry;
 
-	int			indexedColumn;
-
-	mappingOid = get_relname_relid(OBLIV_MAPPING_TABLE_NAME, PG_PUBLIC_NAMESPACE);
-
-	oblivMappingRel = heap_open(mappingOid, RowShareLock);
-
-	oStatus = getOblivTableStatus(oTable, oblivMappingRel);
-
-	mirrorIndexTable = index_open(oStatus.relIndexMirrorId, NoLock);
-
-	/* the current prototype assumes a single indexed column */
-	indexedColumn = mirrorIndexTable->rd_index->indkey.values[0];
-
-	index_close(mirrorIndexTable, NoLock);
-	heap_close(oblivMappingRel, RowShareLock);
+	if (!lookupOblivTable(oTable, &entry))
+		elog(ERROR, "Mapping table %s does not exist", OBLIV_MAPPING_TABLE_NAME);
 
-	return indexedColumn;
+	return entry.indexedColumn;
 }
 
 
@@ -1233,6 +2837,7 @@ foreignInsert(HeapTuple tuple, Relation rel){
 	char	   *indexValue;
 	int			indexValueSize;
     CommandId   cid = 0;
+	instr_time	ecallStart;
 
 	//status = SGX_SUCCESS;
 
@@ -1252,12 +2857,17 @@ foreignInsert(HeapTuple tuple, Relation rel){
 		
 	indexValue = VARDATA_ANY(DatumGetBpCharPP(indexedValueDatum));
 	indexValueSize = bpchartruelen(VARDATA_ANY(DatumGetBpCharPP(indexedValueDatum)), VARSIZE_ANY_EXHDR(DatumGetBpCharPP(indexedValueDatum)));
+	oblivEcallStart(&ecallStart, soeTableOid);
+	oblivStatsInsert();
+	TRACE_OBLIVPG_INSERT_START(soeTableOid, tuple->t_len);
     #ifdef UNSAFE
 		insert((char *) tuple->t_data, tuple->t_len, indexValue, indexValueSize);
     #else
 		insert(enclave_id, (char *) tuple->t_data, tuple->t_len, indexValue, indexValueSize);
 
     #endif
+	TRACE_OBLIVPG_INSERT_DONE(soeTableOid);
+	oblivEcallEnd(&ecallStart, OBLIV_STAT_ECALL_INSERT, tuple->t_len + indexValueSize);
 
 }
 
@@ -1285,6 +2895,7 @@ obliviousExecForeignInsert(EState *estate,
 	bool		isColumnNull;
 	char	   *indexValue;
 	int			indexValueSize;
+	instr_time	ecallStart;
 
 	resultRelInfo = NULL;
 	resultRelationDesc = NULL;
@@ -1319,11 +2930,16 @@ obliviousExecForeignInsert(EState *estate,
 		 * tuple->t_len);
 		 */
 
+		oblivEcallStart(&ecallStart, resultRelationDesc->rd_id);
+		oblivStatsInsert();
+		TRACE_OBLIVPG_INSERT_HEAP_START(resultRelationDesc->rd_id, tuple->t_len);
 #ifdef UNSAFE
 		insertHeap((char *) tuple->t_data, tuple->t_len);
 #else
 		status = insertHeap(enclave_id, (char *) tuple->t_data, tuple->t_len);
 #endif
+		TRACE_OBLIVPG_INSERT_HEAP_DONE(resultRelationDesc->rd_id);
+		oblivEcallEnd(&ecallStart, OBLIV_STAT_ECALL_INSERT, tuple->t_len);
 
 		if (status != SGX_SUCCESS)
 		{
@@ -1369,12 +2985,17 @@ obliviousExecForeignInsert(EState *estate,
 		 * elog(DEBUG1, "Datum to index is %s and has size %d", indexValue,
 		 * indexValueSize);
 		 */
+		oblivEcallStart(&ecallStart, resultRelationDesc->rd_id);
+		oblivStatsInsert();
+		TRACE_OBLIVPG_INSERT_START(resultRelationDesc->rd_id, tuple->t_len);
 #ifdef UNSAFE
 		insert((char *) tuple->t_data, tuple->t_len, indexValue, indexValueSize);
 #else
 		insert(enclave_id, (char *) tuple->t_data, tuple->t_len, indexValue, indexValueSize);
 
 #endif
+		TRACE_OBLIVPG_INSERT_DONE(resultRelationDesc->rd_id);
+		oblivEcallEnd(&ecallStart, OBLIV_STAT_ECALL_INSERT, tuple->t_len + indexValueSize);
 
 	}
 
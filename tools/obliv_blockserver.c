@@ -0,0 +1,472 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_blockserver.c
+ *	  untrusted block server for the remote storage backend
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/tools/obliv_blockserver.c
+ *
+ * Serves the ORAM files of the remote storage backend from the files of a
+ * directory, with the protocol of include/obliv_remote_proto.h. Each
+ * connection is served by its own thread, which answers the requests in
+ * the order they arrive, so the clients can pipeline them. The server only
+ * sees encrypted blocks and their block numbers, like the storage of the
+ * classic ORAM deployments.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../include/obliv_remote_proto.h"
+
+typedef struct Connection
+{
+	int			sock;
+	int			fds[OBLIV_REMOTE_MAX_HANDLES];
+	int			nfiles;
+	uint32_t   *blknos;
+	char	   *pages;
+} Connection;
+
+static const char *dataDir = ".";
+static bool verbose = false;
+
+static void serverError(const char *fmt,...) __attribute__((format(printf, 1, 2), noreturn));
+static bool recvAll(int sock, void *buf, size_t len);
+static bool sendAll(int sock, struct iovec *iov, int iovcnt);
+static bool respond(Connection *conn, const OblivRemoteRequest *req, int status,
+					int handle, int nblocks, const char *payload, size_t length);
+static bool respondError(Connection *conn, const OblivRemoteRequest *req, const char *fmt,...)
+			__attribute__((format(printf, 3, 4)));
+static bool serveRequest(Connection *conn, OblivRemoteRequest *req);
+static void *serveConnection(void *arg);
+static int	listenOn(const char *address);
+
+static void
+serverError(const char *fmt,...)
+{
+	va_list		args;
+
+	fprintf(stderr, "obliv_blockserver: ");
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static bool
+recvAll(int sock, void *buf, size_t len)
+{
+	char	   *ptr = buf;
+
+	while (len > 0)
+	{
+		ssize_t		n = recv(sock, ptr, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		ptr += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool
+sendAll(int sock, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0)
+	{
+		ssize_t		n = writev(sock, iov, iovcnt);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+
+		while (iovcnt > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (char *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return true;
+}
+
+static bool
+respond(Connection *conn, const OblivRemoteRequest *req, int status,
+		int handle, int nblocks, const char *payload, size_t length)
+{
+	OblivRemoteResponse resp;
+	struct iovec iov[2];
+
+	resp.length = htonl((uint32_t) length);
+	resp.id = htonl(req->id);
+	resp.type = req->type;
+	resp.status = (uint8_t) status;
+	resp.handle = htons((uint16_t) handle);
+	resp.nblocks = htonl((uint32_t) nblocks);
+
+	iov[0].iov_base = &resp;
+	iov[0].iov_len = sizeof(resp);
+	iov[1].iov_base = (void *) payload;
+	iov[1].iov_len = length;
+
+	return sendAll(conn->sock, iov, length > 0 ? 2 : 1);
+}
+
+static bool
+respondError(Connection *conn, const OblivRemoteRequest *req, const char *fmt,...)
+{
+	char		message[512];
+	va_list		args;
+
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+
+	if (verbose)
+		fprintf(stderr, "obliv_blockserver: %s\n", message);
+
+	return respond(conn, req, OBLIV_REMOTE_ERROR, 0, 0, message, strlen(message));
+}
+
+/*
+ * Reads the payload of a request and answers it. Returns false when the
+ * connection must be closed.
+ */
+static bool
+serveRequest(Connection *conn, OblivRemoteRequest *req)
+{
+	char		name[OBLIV_REMOTE_MAX_NAME + 1];
+	char		path[1024];
+	size_t		blocksLength = sizeof(uint32_t) * req->nblocks;
+	size_t		pagesLength = (size_t) req->nblocks * req->blockSize;
+	bool		hasBlocks;
+	int			fd = -1;
+	uint32_t	i;
+
+	hasBlocks = req->type == OBLIV_REMOTE_READ || req->type == OBLIV_REMOTE_WRITE ||
+		req->type == OBLIV_REMOTE_PREFETCH;
+
+	/* The frame limits are checked before the payload is read. */
+	if (hasBlocks && (req->nblocks > OBLIV_REMOTE_MAX_BLOCKS ||
+					  req->blockSize > OBLIV_REMOTE_MAX_BLOCK_SIZE ||
+					  req->length != blocksLength + (req->type == OBLIV_REMOTE_WRITE ? pagesLength : 0)))
+		return false;
+	if (req->type == OBLIV_REMOTE_OPEN && req->length > OBLIV_REMOTE_MAX_NAME)
+		return false;
+	if (!hasBlocks && req->type != OBLIV_REMOTE_OPEN && req->length != 0)
+		return false;
+
+	if (req->type != OBLIV_REMOTE_HELLO && req->type != OBLIV_REMOTE_OPEN)
+	{
+		if (req->handle >= conn->nfiles)
+			return false;
+		fd = conn->fds[req->handle];
+	}
+
+	switch (req->type)
+	{
+		case OBLIV_REMOTE_HELLO:
+			if (req->nblocks != OBLIV_REMOTE_VERSION)
+			{
+				respondError(conn, req, "protocol version %u is not supported, the server speaks version %d",
+							 req->nblocks, OBLIV_REMOTE_VERSION);
+				return false;
+			}
+			return respond(conn, req, OBLIV_REMOTE_OK, 0, 0, NULL, 0);
+
+		case OBLIV_REMOTE_OPEN:
+			if (!recvAll(conn->sock, name, req->length))
+				return false;
+			name[req->length] = '\0';
+
+			if (name[0] == '\0' || name[0] == '.' || strchr(name, '/') != NULL)
+				return respondError(conn, req, "invalid file name \"%s\"", name);
+			if (conn->nfiles == OBLIV_REMOTE_MAX_HANDLES)
+				return respondError(conn, req, "too many open files");
+
+			snprintf(path, sizeof(path), "%s/%s", dataDir, name);
+			fd = open(path, O_RDWR | O_CREAT, 0600);
+			if (fd < 0)
+				return respondError(conn, req, "could not open \"%s\": %s", path, strerror(errno));
+
+			conn->fds[conn->nfiles] = fd;
+			if (verbose)
+				fprintf(stderr, "obliv_blockserver: opened %s as handle %d\n", path, conn->nfiles);
+			return respond(conn, req, OBLIV_REMOTE_OK, conn->nfiles++, 0, NULL, 0);
+
+		case OBLIV_REMOTE_READ:
+			if (!recvAll(conn->sock, conn->blknos, blocksLength))
+				return false;
+
+			for (i = 0; i < req->nblocks; i++)
+			{
+				char	   *page = conn->pages + (size_t) i * req->blockSize;
+				off_t		offset = (off_t) ntohl(conn->blknos[i]) * req->blockSize;
+				ssize_t		n = pread(fd, page, req->blockSize, offset);
+
+				if (n < 0)
+					return respondError(conn, req, "could not read block %u: %s",
+										ntohl(conn->blknos[i]), strerror(errno));
+				memset(page + n, 0, req->blockSize - n);
+			}
+			return respond(conn, req, OBLIV_REMOTE_OK, 0, req->nblocks, conn->pages, pagesLength);
+
+		case OBLIV_REMOTE_WRITE:
+			if (!recvAll(conn->sock, conn->blknos, blocksLength) ||
+				!recvAll(conn->sock, conn->pages, pagesLength))
+				return false;
+
+			for (i = 0; i < req->nblocks; i++)
+			{
+				off_t		offset = (off_t) ntohl(conn->blknos[i]) * req->blockSize;
+
+				if (pwrite(fd, conn->pages + (size_t) i * req->blockSize, req->blockSize, offset) != req->blockSize)
+					return respondError(conn, req, "could not write block %u: %s",
+										ntohl(conn->blknos[i]), strerror(errno));
+			}
+			return respond(conn, req, OBLIV_REMOTE_OK, 0, 0, NULL, 0);
+
+		case OBLIV_REMOTE_PREFETCH:
+			if (!recvAll(conn->sock, conn->blknos, blocksLength))
+				return false;
+
+			for (i = 0; i < req->nblocks; i++)
+				posix_fadvise(fd, (off_t) ntohl(conn->blknos[i]) * req->blockSize,
+							  req->blockSize, POSIX_FADV_WILLNEED);
+			return respond(conn, req, OBLIV_REMOTE_OK, 0, 0, NULL, 0);
+
+		case OBLIV_REMOTE_ALLOCATE:
+			/* The file is left sparse, the blocks read as zeros. */
+			if (ftruncate(fd, 0) != 0 ||
+				ftruncate(fd, (off_t) req->nblocks * req->blockSize) != 0)
+				return respondError(conn, req, "could not allocate %u blocks: %s",
+									req->nblocks, strerror(errno));
+			return respond(conn, req, OBLIV_REMOTE_OK, 0, 0, NULL, 0);
+
+		case OBLIV_REMOTE_SYNC:
+			if (fdatasync(fd) != 0)
+				return respondError(conn, req, "could not sync file: %s", strerror(errno));
+			return respond(conn, req, OBLIV_REMOTE_OK, 0, 0, NULL, 0);
+
+		default:
+			return false;
+	}
+}
+
+static void *
+serveConnection(void *arg)
+{
+	Connection *conn = (Connection *) arg;
+	OblivRemoteRequest req;
+	bool		hello = false;
+	int			i;
+
+	conn->blknos = malloc(sizeof(uint32_t) * OBLIV_REMOTE_MAX_BLOCKS);
+	conn->pages = malloc((size_t) OBLIV_REMOTE_MAX_BLOCKS * OBLIV_REMOTE_MAX_BLOCK_SIZE);
+
+	while (conn->blknos != NULL && conn->pages != NULL &&
+		   recvAll(conn->sock, &req, sizeof(req)))
+	{
+		req.length = ntohl(req.length);
+		req.id = ntohl(req.id);
+		req.nblocks = ntohl(req.nblocks);
+		req.blockSize = ntohl(req.blockSize);
+
+		/* The first request of a connection must be a HELLO. */
+		if (!hello && req.type != OBLIV_REMOTE_HELLO)
+			break;
+		if (!serveRequest(conn, &req))
+			break;
+		hello = true;
+	}
+
+	if (verbose)
+		fprintf(stderr, "obliv_blockserver: connection closed\n");
+
+	for (i = 0; i < conn->nfiles; i++)
+	{
+		fdatasync(conn->fds[i]);
+		close(conn->fds[i]);
+	}
+	close(conn->sock);
+	free(conn->blknos);
+	free(conn->pages);
+	free(conn);
+
+	return NULL;
+}
+
+/*
+ * Listens on "host:port", ":port", or the path of a Unix socket.
+ */
+static int
+listenOn(const char *address)
+{
+	int			sock;
+
+	if (address[0] == '/')
+	{
+		struct sockaddr_un addr;
+
+		if (strlen(address) >= sizeof(addr.sun_path))
+			serverError("socket path \"%s\" is too long", address);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, address);
+		unlink(address);
+
+		sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+			serverError("could not bind \"%s\": %s", address, strerror(errno));
+	}
+	else
+	{
+		struct addrinfo hints;
+		struct addrinfo *res;
+		const char *colon = strrchr(address, ':');
+		char		host[256];
+		int			one = 1;
+		int			rc;
+
+		if (colon == NULL || (size_t) (colon - address) >= sizeof(host))
+			serverError("invalid address \"%s\"", address);
+		memcpy(host, address, colon - address);
+		host[colon - address] = '\0';
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		rc = getaddrinfo(host[0] != '\0' ? host : NULL, colon + 1, &hints, &res);
+		if (rc != 0)
+			serverError("could not resolve \"%s\": %s", address, gai_strerror(rc));
+
+		sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		if (sock < 0)
+			serverError("could not create socket: %s", strerror(errno));
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(sock, res->ai_addr, res->ai_addrlen) != 0)
+			serverError("could not bind \"%s\": %s", address, strerror(errno));
+		freeaddrinfo(res);
+	}
+
+	if (listen(sock, 64) != 0)
+		serverError("could not listen on \"%s\": %s", address, strerror(errno));
+
+	return sock;
+}
+
+static void
+usage(void)
+{
+	printf("obliv_blockserver serves the ORAM files of the remote storage backend.\n\n"
+		   "Usage:\n"
+		   "  obliv_blockserver [OPTION]... ADDRESS\n\n"
+		   "ADDRESS is host:port, :port or the path of a Unix socket.\n\n"
+		   "Options:\n"
+		   "  -d DIR      directory of the ORAM files (default .)\n"
+		   "  -v          log the connections and the errors\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	int			listenSock;
+	int			c;
+
+	while ((c = getopt(argc, argv, "d:vh")) != -1)
+	{
+		switch (c)
+		{
+			case 'd':
+				dataDir = optarg;
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+
+	if (optind != argc - 1)
+	{
+		usage();
+		exit(1);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	listenSock = listenOn(argv[optind]);
+
+	for (;;)
+	{
+		Connection *conn;
+		pthread_t	thread;
+		int			sock;
+		int			one = 1;
+
+		sock = accept(listenSock, NULL, NULL);
+		if (sock < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			serverError("could not accept a connection: %s", strerror(errno));
+		}
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		conn = calloc(1, sizeof(Connection));
+		if (conn == NULL)
+			serverError("out of memory");
+		conn->sock = sock;
+
+		if (pthread_create(&thread, NULL, serveConnection, conn) != 0)
+			serverError("could not create a thread: %s", strerror(errno));
+		pthread_detach(thread);
+
+		if (verbose)
+			fprintf(stderr, "obliv_blockserver: connection accepted\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,1164 @@
+/*-------------------------------------------------------------------------
+ *
+ * obliv_replay.c
+ *	  replays a capture of the ORAM block accesses against a storage backend
+ *
+ *  Copyright (c) 2018-2019, HASLab
+ *
+ *
+ * IDENTIFICATION
+ * contrib/oblivpg_fdw/tools/obliv_replay.c
+ *
+ * The captures are written by the ocalls when oblivpg_fdw.capture_file is
+ * set. Each ocall of the capture is replayed as one request, and the next
+ * request is only issued when the previous one is done, as the enclave
+ * waits for each ocall. The blocks of a request are issued by up to
+ * queue depth workers at the same time. The ORAM files are stand-in files
+ * created in the data directory with the size of the largest block of the
+ * capture, so neither SGX nor a server are needed.
+ *
+ * The backends are:
+ *
+ * bufmgr	a clock-sweep cache of -B buffers over buffered I/O, like shared
+ *			buffers. The misses of a read request are prefetched with
+ *			posix_fadvise, at most queue depth at a time, as done by the
+ *			PrefetchBuffer calls of the ocalls, and then read in turn.
+ * direct	pread and pwrite with O_DIRECT.
+ * mmap		copies from and to a shared mapping of the files.
+ * remote	with -a, the files are stored by tools/obliv_blockserver and
+ *			each request is a single frame, as sent by the remote storage
+ *			backend; up to queue depth writes are pipelined. Without -a,
+ *			buffered I/O with a round trip of -l microseconds per block
+ *			stands in for a server that pipelines queue depth blocks.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../include/obliv_capture.h"
+#include "../include/obliv_remote_proto.h"
+
+#define REPLAY_NFILES 2
+#define REPLAY_ALIGN 4096
+#define REPLAY_MAX_USAGE 5
+
+typedef struct Replay Replay;
+
+typedef struct ReplayBackend
+{
+	const char *name;
+	void		(*open) (Replay *replay);
+	void		(*close) (Replay *replay);
+	/* replays the n blocks of an ocall */
+	void		(*request) (Replay *replay, const OblivCaptureRecord *recs, int n);
+} ReplayBackend;
+
+/* Workers issuing the blocks of a request in parallel */
+typedef struct ReplayPool
+{
+	pthread_t  *threads;
+	int			nthreads;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	const OblivCaptureRecord *recs; /* request being replayed */
+	int			n;
+	int			next;			/* next block to issue */
+	int			finished;
+	bool		stop;
+	void		(*block) (Replay *replay, const OblivCaptureRecord *rec, char *page);
+} ReplayPool;
+
+/* Buffer of the bufmgr backend */
+typedef struct ReplayBuffer
+{
+	int			fileId;			/* -1 if free */
+	uint32_t	blkno;
+	int			usage;
+	bool		dirty;
+} ReplayBuffer;
+
+struct Replay
+{
+	const ReplayBackend *backend;
+	const char *dir;
+	int			queueDepth;
+	int			nbuffers;
+	long		latency;		/* remote round trip in microseconds */
+	const char *address;		/* block server of the remote backend */
+
+	OblivCaptureRecord *recs;
+	long		nrecs;
+	uint32_t	blockSize;		/* largest block of the capture */
+	uint32_t	fileBlocks[REPLAY_NFILES];
+
+	int			fds[REPLAY_NFILES];
+	char	   *maps[REPLAY_NFILES];
+	ReplayPool	pool;
+
+	/* bufmgr */
+	ReplayBuffer *buffers;
+	char	   *bufferPages;
+	int		   *bufferOf[REPLAY_NFILES];	/* buffer of each block, or -1 */
+	int			clockHand;
+	long		hits;
+	long		misses;
+	long		evictions;
+
+	/* remote with a block server */
+	int			sock;
+	int			handles[REPLAY_NFILES];
+	uint32_t	nextId;
+	int			pending;		/* requests without their response read */
+	uint32_t   *netBlknos;
+};
+
+static void replayError(const char *fmt,...) __attribute__((format(printf, 1, 2), noreturn));
+static double elapsedUsec(const struct timespec *start, const struct timespec *end);
+static void *allocAligned(size_t size);
+static void loadCapture(Replay *replay, const char *path);
+static void createFiles(Replay *replay, int flags);
+static void closeFiles(Replay *replay);
+static void poolStart(Replay *replay, void (*block) (Replay *, const OblivCaptureRecord *, char *));
+static void poolStop(Replay *replay);
+static void poolRun(Replay *replay, const OblivCaptureRecord *recs, int n);
+static void *poolWorker(void *arg);
+static void fileBlock(Replay *replay, const OblivCaptureRecord *rec, char *page);
+static void bufmgrOpen(Replay *replay);
+static void bufmgrClose(Replay *replay);
+static void bufmgrRequest(Replay *replay, const OblivCaptureRecord *recs, int n);
+static void directOpen(Replay *replay);
+static void mmapOpen(Replay *replay);
+static void mmapClose(Replay *replay);
+static void mmapBlock(Replay *replay, const OblivCaptureRecord *rec, char *page);
+static void remoteOpen(Replay *replay);
+static void remoteClose(Replay *replay);
+static void remoteRequest(Replay *replay, const OblivCaptureRecord *recs, int n);
+static void remoteBlock(Replay *replay, const OblivCaptureRecord *rec, char *page);
+static void serverConnect(Replay *replay);
+static uint32_t serverSend(Replay *replay, int type, int handle, uint32_t nblocks, uint32_t blockSize,
+						   const void *payload, size_t length, const char *pages);
+static void recvAll(Replay *replay, void *buf, size_t len);
+static void serverReceive(Replay *replay, char *pages, size_t length, int *handle);
+static void serverDrain(Replay *replay, int maxPending);
+static void serverOpen(Replay *replay);
+static void serverClose(Replay *replay);
+static void serverRequest(Replay *replay, const OblivCaptureRecord *recs, int n);
+static void poolClose(Replay *replay);
+static void poolRequest(Replay *replay, const OblivCaptureRecord *recs, int n);
+static int	compareDouble(const void *a, const void *b);
+static void printLatencies(const char *label, double *lat, long n);
+
+static const ReplayBackend backends[] = {
+	{"bufmgr", bufmgrOpen, bufmgrClose, bufmgrRequest},
+	{"direct", directOpen, poolClose, poolRequest},
+	{"mmap", mmapOpen, mmapClose, poolRequest},
+	{"remote", remoteOpen, remoteClose, remoteRequest},
+	{NULL, NULL, NULL, NULL}
+};
+
+static void
+replayError(const char *fmt,...)
+{
+	va_list		args;
+
+	fprintf(stderr, "obliv_replay: ");
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static double
+elapsedUsec(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000.0 +
+		(end->tv_nsec - start->tv_nsec) / 1000.0;
+}
+
+static void *
+allocAligned(size_t size)
+{
+	void	   *ptr;
+
+	if (posix_memalign(&ptr, REPLAY_ALIGN, size) != 0)
+		replayError("out of memory");
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+/*
+ * Appends the records of a capture file to the replay.
+ */
+static void
+loadCapture(Replay *replay, const char *path)
+{
+	FILE	   *fp;
+	OblivCaptureHeader header;
+	struct stat st;
+	long		nrecs;
+	long		i;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		replayError("could not open capture file \"%s\": %s", path, strerror(errno));
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != OBLIV_CAPTURE_MAGIC)
+		replayError("\"%s\" is not a capture file of this host", path);
+	if (header.version != OBLIV_CAPTURE_VERSION || header.recordSize != sizeof(OblivCaptureRecord))
+		replayError("capture file \"%s\" has version %d, expected %d",
+					path, header.version, OBLIV_CAPTURE_VERSION);
+
+	if (fstat(fileno(fp), &st) != 0)
+		replayError("could not stat capture file \"%s\": %s", path, strerror(errno));
+	nrecs = (st.st_size - sizeof(header)) / sizeof(OblivCaptureRecord);
+
+	replay->recs = realloc(replay->recs, sizeof(OblivCaptureRecord) * (replay->nrecs + nrecs));
+	if (replay->recs == NULL)
+		replayError("out of memory");
+
+	nrecs = fread(replay->recs + replay->nrecs, sizeof(OblivCaptureRecord), nrecs, fp);
+
+	for (i = replay->nrecs; i < replay->nrecs + nrecs; i++)
+	{
+		OblivCaptureRecord *rec = &replay->recs[i];
+
+		if (rec->fileId >= REPLAY_NFILES)
+			replayError("capture file \"%s\" has a record of file %d", path, rec->fileId);
+		if (rec->size > replay->blockSize)
+			replay->blockSize = rec->size;
+		if (rec->blkno + 1 > replay->fileBlocks[rec->fileId])
+			replay->fileBlocks[rec->fileId] = rec->blkno + 1;
+	}
+
+	/* The first ocall of a capture cannot continue the last one of another. */
+	if (nrecs > 0)
+		replay->recs[replay->nrecs].flags &= ~OBLIV_CAPTURE_CONT;
+
+	replay->nrecs += nrecs;
+	fclose(fp);
+}
+
+/*
+ * Creates the stand-in ORAM files, written in full so that the reads do
+ * not hit holes, and opens them with flags.
+ */
+static void
+createFiles(Replay *replay, int flags)
+{
+	char	   *zero = allocAligned(replay->blockSize);
+	int			fileId;
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+	{
+		char		path[1024];
+		struct stat st;
+		off_t		size = (off_t) replay->fileBlocks[fileId] * replay->blockSize;
+		off_t		offset;
+		int			fd;
+
+		snprintf(path, sizeof(path), "%s/obliv_replay.%d", replay->dir, fileId);
+
+		fd = open(path, O_RDWR | O_CREAT, 0600);
+		if (fd < 0 || fstat(fd, &st) != 0)
+			replayError("could not open \"%s\": %s", path, strerror(errno));
+
+		for (offset = st.st_size - st.st_size % replay->blockSize; offset < size; offset += replay->blockSize)
+		{
+			if (pwrite(fd, zero, replay->blockSize, offset) != replay->blockSize)
+				replayError("could not write \"%s\": %s", path, strerror(errno));
+		}
+		if (fsync(fd) != 0)
+			replayError("could not fsync \"%s\": %s", path, strerror(errno));
+		close(fd);
+
+		replay->fds[fileId] = open(path, O_RDWR | flags);
+		if (replay->fds[fileId] < 0)
+			replayError("could not open \"%s\": %s", path, strerror(errno));
+	}
+
+	free(zero);
+}
+
+static void
+closeFiles(Replay *replay)
+{
+	int			fileId;
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+	{
+		if (fsync(replay->fds[fileId]) != 0)
+			replayError("could not fsync file %d: %s", fileId, strerror(errno));
+		close(replay->fds[fileId]);
+	}
+}
+
+static void
+poolStart(Replay *replay, void (*block) (Replay *, const OblivCaptureRecord *, char *))
+{
+	ReplayPool *pool = &replay->pool;
+	int			i;
+
+	pool->nthreads = replay->queueDepth;
+	pool->threads = malloc(sizeof(pthread_t) * pool->nthreads);
+	pool->block = block;
+	pool->n = 0;
+	pool->next = 0;
+	pool->finished = 0;
+	pool->stop = false;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (i = 0; i < pool->nthreads; i++)
+	{
+		if (pthread_create(&pool->threads[i], NULL, poolWorker, replay) != 0)
+			replayError("could not create worker thread");
+	}
+}
+
+static void
+poolStop(Replay *replay)
+{
+	ReplayPool *pool = &replay->pool;
+	int			i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+	free(pool->threads);
+}
+
+/*
+ * Issues the blocks of a request to the workers and waits for all of them.
+ */
+static void
+poolRun(Replay *replay, const OblivCaptureRecord *recs, int n)
+{
+	ReplayPool *pool = &replay->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->recs = recs;
+	pool->n = n;
+	pool->next = 0;
+	pool->finished = 0;
+	pthread_cond_broadcast(&pool->work);
+	while (pool->finished < n)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void *
+poolWorker(void *arg)
+{
+	Replay	   *replay = (Replay *) arg;
+	ReplayPool *pool = &replay->pool;
+	char	   *page = allocAligned(replay->blockSize);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		const OblivCaptureRecord *rec;
+
+		while (!pool->stop && pool->next >= pool->n)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->stop)
+			break;
+
+		rec = &pool->recs[pool->next++];
+		pthread_mutex_unlock(&pool->lock);
+
+		pool->block(replay, rec, page);
+
+		pthread_mutex_lock(&pool->lock);
+		if (++pool->finished == pool->n)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	free(page);
+	return NULL;
+}
+
+/*
+ * Reads or writes a block of a stand-in file with pread or pwrite.
+ */
+static void
+fileBlock(Replay *replay, const OblivCaptureRecord *rec, char *page)
+{
+	off_t		offset = (off_t) rec->blkno * replay->blockSize;
+	ssize_t		done;
+
+	if (rec->op == OBLIV_CAPTURE_WRITE)
+		done = pwrite(replay->fds[rec->fileId], page, rec->size, offset);
+	else
+		done = pread(replay->fds[rec->fileId], page, rec->size, offset);
+
+	if (done != rec->size)
+		replayError("could not %s block %u of file %d: %s",
+					rec->op == OBLIV_CAPTURE_WRITE ? "write" : "read",
+					rec->blkno, rec->fileId, strerror(errno));
+}
+
+static void
+poolClose(Replay *replay)
+{
+	poolStop(replay);
+	closeFiles(replay);
+}
+
+static void
+poolRequest(Replay *replay, const OblivCaptureRecord *recs, int n)
+{
+	poolRun(replay, recs, n);
+}
+
+static void
+directOpen(Replay *replay)
+{
+	if (replay->blockSize % REPLAY_ALIGN != 0)
+		replayError("direct I/O needs blocks of a multiple of %d bytes", REPLAY_ALIGN);
+
+	createFiles(replay, O_DIRECT);
+	poolStart(replay, fileBlock);
+}
+
+static void
+mmapOpen(Replay *replay)
+{
+	int			fileId;
+
+	createFiles(replay, 0);
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+	{
+		size_t		size = (size_t) replay->fileBlocks[fileId] * replay->blockSize;
+
+		replay->maps[fileId] = NULL;
+		if (size == 0)
+			continue;
+
+		replay->maps[fileId] = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+									replay->fds[fileId], 0);
+		if (replay->maps[fileId] == MAP_FAILED)
+			replayError("could not map file %d: %s", fileId, strerror(errno));
+	}
+
+	poolStart(replay, mmapBlock);
+}
+
+static void
+mmapClose(Replay *replay)
+{
+	int			fileId;
+
+	poolStop(replay);
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+	{
+		size_t		size = (size_t) replay->fileBlocks[fileId] * replay->blockSize;
+
+		if (replay->maps[fileId] == NULL)
+			continue;
+		if (msync(replay->maps[fileId], size, MS_SYNC) != 0)
+			replayError("could not msync file %d: %s", fileId, strerror(errno));
+		munmap(replay->maps[fileId], size);
+	}
+
+	closeFiles(replay);
+}
+
+static void
+mmapBlock(Replay *replay, const OblivCaptureRecord *rec, char *page)
+{
+	char	   *block = replay->maps[rec->fileId] + (size_t) rec->blkno * replay->blockSize;
+
+	if (rec->op == OBLIV_CAPTURE_WRITE)
+		memcpy(block, page, rec->size);
+	else
+		memcpy(page, block, rec->size);
+}
+
+static void
+remoteOpen(Replay *replay)
+{
+	if (replay->address != NULL)
+	{
+		serverOpen(replay);
+		return;
+	}
+
+	createFiles(replay, 0);
+	poolStart(replay, remoteBlock);
+}
+
+static void
+remoteClose(Replay *replay)
+{
+	if (replay->address != NULL)
+		serverClose(replay);
+	else
+		poolClose(replay);
+}
+
+static void
+remoteRequest(Replay *replay, const OblivCaptureRecord *recs, int n)
+{
+	if (replay->address != NULL)
+		serverRequest(replay, recs, n);
+	else
+		poolRun(replay, recs, n);
+}
+
+/*
+ * A block of the remote stand-in waits for the round trip to the server
+ * before it is served from the local file.
+ */
+static void
+remoteBlock(Replay *replay, const OblivCaptureRecord *rec, char *page)
+{
+	struct timespec delay;
+
+	delay.tv_sec = replay->latency / 1000000;
+	delay.tv_nsec = (replay->latency % 1000000) * 1000;
+	while (nanosleep(&delay, &delay) != 0 && errno == EINTR)
+		;
+
+	fileBlock(replay, rec, page);
+}
+
+/*
+ * Connects to the block server at "host:port" or the path of a Unix socket.
+ */
+static void
+serverConnect(Replay *replay)
+{
+	int			one = 1;
+
+	if (replay->address[0] == '/')
+	{
+		struct sockaddr_un addr;
+
+		if (strlen(replay->address) >= sizeof(addr.sun_path))
+			replayError("socket path \"%s\" is too long", replay->address);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, replay->address);
+
+		replay->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (replay->sock < 0 || connect(replay->sock, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+			replayError("could not connect to \"%s\": %s", replay->address, strerror(errno));
+	}
+	else
+	{
+		struct addrinfo hints;
+		struct addrinfo *res;
+		const char *colon = strrchr(replay->address, ':');
+		char		host[256];
+		int			rc;
+
+		if (colon == NULL || (size_t) (colon - replay->address) >= sizeof(host))
+			replayError("invalid address \"%s\"", replay->address);
+		memcpy(host, replay->address, colon - replay->address);
+		host[colon - replay->address] = '\0';
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		rc = getaddrinfo(host, colon + 1, &hints, &res);
+		if (rc != 0)
+			replayError("could not resolve \"%s\": %s", replay->address, gai_strerror(rc));
+
+		replay->sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		if (replay->sock < 0 || connect(replay->sock, res->ai_addr, res->ai_addrlen) != 0)
+			replayError("could not connect to \"%s\": %s", replay->address, strerror(errno));
+		freeaddrinfo(res);
+
+		setsockopt(replay->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+}
+
+/*
+ * Sends a request without waiting for its response. The payload is the
+ * given bytes followed by the pages of a write.
+ */
+static uint32_t
+serverSend(Replay *replay, int type, int handle, uint32_t nblocks, uint32_t blockSize,
+		   const void *payload, size_t length, const char *pages)
+{
+	OblivRemoteRequest req;
+	struct iovec iov[3];
+	struct iovec *next = iov;
+	int			iovcnt = 1;
+	size_t		pagesLength = pages != NULL ? (size_t) nblocks * blockSize : 0;
+
+	req.length = htonl((uint32_t) (length + pagesLength));
+	req.id = htonl(replay->nextId);
+	req.type = (uint8_t) type;
+	req.handle = (uint8_t) handle;
+	req.reserved = 0;
+	req.nblocks = htonl(nblocks);
+	req.blockSize = htonl(blockSize);
+
+	iov[0].iov_base = &req;
+	iov[0].iov_len = sizeof(req);
+	if (length > 0)
+	{
+		iov[iovcnt].iov_base = (void *) payload;
+		iov[iovcnt++].iov_len = length;
+	}
+	if (pagesLength > 0)
+	{
+		iov[iovcnt].iov_base = (void *) pages;
+		iov[iovcnt++].iov_len = pagesLength;
+	}
+
+	while (iovcnt > 0)
+	{
+		ssize_t		n = writev(replay->sock, next, iovcnt);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			replayError("could not send to the block server: %s", strerror(errno));
+
+		while (iovcnt > 0 && (size_t) n >= next->iov_len)
+		{
+			n -= next->iov_len;
+			next++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			next->iov_base = (char *) next->iov_base + n;
+			next->iov_len -= n;
+		}
+	}
+
+	replay->pending++;
+	return replay->nextId++;
+}
+
+static void
+recvAll(Replay *replay, void *buf, size_t len)
+{
+	char	   *ptr = buf;
+
+	while (len > 0)
+	{
+		ssize_t		n = recv(replay->sock, ptr, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			replayError("could not receive from the block server: %s",
+						n == 0 ? "connection closed" : strerror(errno));
+		ptr += n;
+		len -= n;
+	}
+}
+
+/*
+ * Reads the response of the oldest pending request, with a payload of
+ * length bytes stored in pages.
+ */
+static void
+serverReceive(Replay *replay, char *pages, size_t length, int *handle)
+{
+	OblivRemoteResponse resp;
+	uint32_t	id = replay->nextId - replay->pending;
+
+	recvAll(replay, &resp, sizeof(resp));
+	replay->pending--;
+
+	if (ntohl(resp.id) != id)
+		replayError("the block server answered request %u instead of request %u", ntohl(resp.id), id);
+
+	if (resp.status != OBLIV_REMOTE_OK)
+	{
+		char		message[512];
+		size_t		messageLength = ntohl(resp.length);
+
+		if (messageLength >= sizeof(message))
+			messageLength = sizeof(message) - 1;
+		recvAll(replay, message, messageLength);
+		message[messageLength] = '\0';
+		replayError("the block server failed: %s", message);
+	}
+
+	if (ntohl(resp.length) != length)
+		replayError("the block server returned %u bytes instead of %zu", ntohl(resp.length), length);
+	if (length > 0)
+		recvAll(replay, pages, length);
+	if (handle != NULL)
+		*handle = ntohs(resp.handle);
+}
+
+static void
+serverDrain(Replay *replay, int maxPending)
+{
+	while (replay->pending > maxPending)
+		serverReceive(replay, NULL, 0, NULL);
+}
+
+/*
+ * Opens the ORAM files on the block server and writes every block, so that
+ * the reads do not hit holes.
+ */
+static void
+serverOpen(Replay *replay)
+{
+	char	   *pages = allocAligned((size_t) OBLIV_REMOTE_MAX_BLOCKS * replay->blockSize);
+	int			fileId;
+
+	replay->netBlknos = malloc(sizeof(uint32_t) * OBLIV_REMOTE_MAX_BLOCKS);
+	if (replay->netBlknos == NULL)
+		replayError("out of memory");
+
+	serverConnect(replay);
+	serverSend(replay, OBLIV_REMOTE_HELLO, 0, OBLIV_REMOTE_VERSION, 0, NULL, 0, NULL);
+	serverReceive(replay, NULL, 0, NULL);
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+	{
+		char		name[64];
+		uint32_t	blkno;
+
+		snprintf(name, sizeof(name), "obliv_replay.%d", fileId);
+		serverSend(replay, OBLIV_REMOTE_OPEN, 0, 0, 0, name, strlen(name), NULL);
+		serverReceive(replay, NULL, 0, &replay->handles[fileId]);
+
+		serverSend(replay, OBLIV_REMOTE_ALLOCATE, replay->handles[fileId],
+				   replay->fileBlocks[fileId], replay->blockSize, NULL, 0, NULL);
+
+		for (blkno = 0; blkno < replay->fileBlocks[fileId]; blkno += OBLIV_REMOTE_MAX_BLOCKS)
+		{
+			uint32_t	n = replay->fileBlocks[fileId] - blkno;
+			uint32_t	i;
+
+			if (n > OBLIV_REMOTE_MAX_BLOCKS)
+				n = OBLIV_REMOTE_MAX_BLOCKS;
+			for (i = 0; i < n; i++)
+				replay->netBlknos[i] = htonl(blkno + i);
+
+			serverSend(replay, OBLIV_REMOTE_WRITE, replay->handles[fileId], n, replay->blockSize,
+					   replay->netBlknos, sizeof(uint32_t) * n, pages);
+			serverDrain(replay, replay->queueDepth - 1);
+		}
+
+		serverSend(replay, OBLIV_REMOTE_SYNC, replay->handles[fileId], 0, 0, NULL, 0, NULL);
+		serverDrain(replay, 0);
+	}
+
+	free(pages);
+}
+
+static void
+serverClose(Replay *replay)
+{
+	int			fileId;
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+		serverSend(replay, OBLIV_REMOTE_SYNC, replay->handles[fileId], 0, 0, NULL, 0, NULL);
+	serverDrain(replay, 0);
+
+	close(replay->sock);
+	free(replay->netBlknos);
+}
+
+/*
+ * Sends the blocks of a request in a single frame, as the remote storage
+ * backend does for an ORAM path. Writes are pipelined, a read waits for
+ * the responses of the pending writes and for its own.
+ */
+static void
+serverRequest(Replay *replay, const OblivCaptureRecord *recs, int n)
+{
+	static char *pages = NULL;
+	int			offset;
+
+	if (pages == NULL)
+		pages = allocAligned((size_t) OBLIV_REMOTE_MAX_BLOCKS * replay->blockSize);
+
+	for (offset = 0; offset < n; offset += OBLIV_REMOTE_MAX_BLOCKS)
+	{
+		int			nframe = n - offset < OBLIV_REMOTE_MAX_BLOCKS ? n - offset : OBLIV_REMOTE_MAX_BLOCKS;
+		int			i;
+
+		for (i = 0; i < nframe; i++)
+			replay->netBlknos[i] = htonl(recs[offset + i].blkno);
+
+		if (recs[0].op == OBLIV_CAPTURE_WRITE)
+		{
+			serverDrain(replay, replay->queueDepth - 1);
+			serverSend(replay, OBLIV_REMOTE_WRITE, replay->handles[recs[0].fileId], nframe,
+					   replay->blockSize, replay->netBlknos, sizeof(uint32_t) * nframe, pages);
+		}
+		else
+		{
+			serverSend(replay, OBLIV_REMOTE_READ, replay->handles[recs[0].fileId], nframe,
+					   replay->blockSize, replay->netBlknos, sizeof(uint32_t) * nframe, NULL);
+			serverDrain(replay, 1);
+			serverReceive(replay, pages, (size_t) nframe * replay->blockSize, NULL);
+		}
+	}
+}
+
+static void
+bufmgrOpen(Replay *replay)
+{
+	int			fileId;
+	int			i;
+
+	createFiles(replay, 0);
+
+	replay->buffers = malloc(sizeof(ReplayBuffer) * replay->nbuffers);
+	replay->bufferPages = allocAligned((size_t) replay->nbuffers * replay->blockSize);
+	if (replay->buffers == NULL)
+		replayError("out of memory");
+	for (i = 0; i < replay->nbuffers; i++)
+	{
+		replay->buffers[i].fileId = -1;
+		replay->buffers[i].usage = 0;
+		replay->buffers[i].dirty = false;
+	}
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+	{
+		replay->bufferOf[fileId] = malloc(sizeof(int) * (replay->fileBlocks[fileId] + 1));
+		if (replay->bufferOf[fileId] == NULL)
+			replayError("out of memory");
+		for (i = 0; i <= (int) replay->fileBlocks[fileId]; i++)
+			replay->bufferOf[fileId][i] = -1;
+	}
+
+	replay->clockHand = 0;
+}
+
+static void
+bufmgrClose(Replay *replay)
+{
+	int			fileId;
+	int			i;
+
+	/* The dirty buffers are written back like a checkpoint would. */
+	for (i = 0; i < replay->nbuffers; i++)
+	{
+		ReplayBuffer *buf = &replay->buffers[i];
+
+		if (buf->fileId >= 0 && buf->dirty)
+		{
+			OblivCaptureRecord rec = {buf->blkno, replay->blockSize, buf->fileId, OBLIV_CAPTURE_WRITE, 0};
+
+			fileBlock(replay, &rec, replay->bufferPages + (size_t) i * replay->blockSize);
+		}
+	}
+
+	for (fileId = 0; fileId < REPLAY_NFILES; fileId++)
+		free(replay->bufferOf[fileId]);
+	free(replay->buffers);
+	free(replay->bufferPages);
+
+	closeFiles(replay);
+}
+
+/*
+ * Returns the buffer of a block, reading the block on a miss after
+ * evicting a victim chosen by the clock sweep.
+ */
+static int
+bufmgrPin(Replay *replay, const OblivCaptureRecord *rec)
+{
+	int			bufId = replay->bufferOf[rec->fileId][rec->blkno];
+	ReplayBuffer *buf;
+	OblivCaptureRecord io;
+
+	if (bufId >= 0)
+	{
+		buf = &replay->buffers[bufId];
+		if (buf->usage < REPLAY_MAX_USAGE)
+			buf->usage++;
+		replay->hits++;
+		return bufId;
+	}
+
+	for (;;)
+	{
+		bufId = replay->clockHand;
+		replay->clockHand = (replay->clockHand + 1) % replay->nbuffers;
+		buf = &replay->buffers[bufId];
+
+		if (buf->fileId < 0 || buf->usage == 0)
+			break;
+		buf->usage--;
+	}
+
+	if (buf->fileId >= 0)
+	{
+		if (buf->dirty)
+		{
+			io.blkno = buf->blkno;
+			io.size = replay->blockSize;
+			io.fileId = buf->fileId;
+			io.op = OBLIV_CAPTURE_WRITE;
+			io.flags = 0;
+			fileBlock(replay, &io, replay->bufferPages + (size_t) bufId * replay->blockSize);
+		}
+		replay->bufferOf[buf->fileId][buf->blkno] = -1;
+		replay->evictions++;
+	}
+
+	io = *rec;
+	io.op = OBLIV_CAPTURE_READ;
+	fileBlock(replay, &io, replay->bufferPages + (size_t) bufId * replay->blockSize);
+
+	buf->fileId = rec->fileId;
+	buf->blkno = rec->blkno;
+	buf->usage = 1;
+	buf->dirty = false;
+	replay->bufferOf[rec->fileId][rec->blkno] = bufId;
+	replay->misses++;
+
+	return bufId;
+}
+
+static void
+bufmgrRequest(Replay *replay, const OblivCaptureRecord *recs, int n)
+{
+	static char *page = NULL;
+	int			prefetched = 0;
+	int			i;
+
+	if (page == NULL)
+		page = allocAligned(replay->blockSize);
+
+	for (i = 0; i < n; i++)
+	{
+		const OblivCaptureRecord *rec = &recs[i];
+		char	   *bufPage;
+		int			bufId;
+
+		/* Keeps queue depth prefetches of the next misses in flight. */
+		if (n > 1)
+		{
+			while (prefetched < n && prefetched < i + replay->queueDepth)
+			{
+				const OblivCaptureRecord *next = &recs[prefetched++];
+
+				if (replay->bufferOf[next->fileId][next->blkno] < 0)
+					posix_fadvise(replay->fds[next->fileId], (off_t) next->blkno * replay->blockSize,
+								  replay->blockSize, POSIX_FADV_WILLNEED);
+			}
+		}
+
+		bufId = bufmgrPin(replay, rec);
+		bufPage = replay->bufferPages + (size_t) bufId * replay->blockSize;
+
+		if (rec->op == OBLIV_CAPTURE_WRITE)
+		{
+			memcpy(bufPage, page, rec->size);
+			replay->buffers[bufId].dirty = true;
+		}
+		else
+			memcpy(page, bufPage, rec->size);
+	}
+}
+
+static int
+compareDouble(const void *a, const void *b)
+{
+	double		x = *(const double *) a;
+	double		y = *(const double *) b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void
+printLatencies(const char *label, double *lat, long n)
+{
+	double		sum = 0;
+	long		i;
+
+	if (n == 0)
+		return;
+
+	qsort(lat, n, sizeof(double), compareDouble);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+
+	printf("%-6s requests %ld, latency us: mean %.1f p50 %.1f p95 %.1f p99 %.1f max %.1f\n",
+		   label, n, sum / n, lat[n / 2], lat[(long) (n * 0.95)], lat[(long) (n * 0.99)], lat[n - 1]);
+}
+
+static void
+usage(void)
+{
+	printf("obliv_replay replays captures of the ORAM block accesses.\n\n"
+		   "Usage:\n"
+		   "  obliv_replay [OPTION]... CAPTURE...\n\n"
+		   "Options:\n"
+		   "  -b BACKEND  bufmgr, direct, mmap or remote (default bufmgr)\n"
+		   "  -q DEPTH    blocks in flight per request (default 1)\n"
+		   "  -d DIR      directory of the stand-in ORAM files (default .)\n"
+		   "  -B NBUFFERS buffers of the bufmgr backend (default 16384)\n"
+		   "  -l USEC     round trip of the remote stand-in (default 100)\n"
+		   "  -a ADDRESS  block server of the remote backend, host:port or socket path\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	Replay		replay;
+	const char *backendName = "bufmgr";
+	struct timespec start;
+	struct timespec end;
+	struct timespec reqStart;
+	struct timespec reqEnd;
+	double	   *readLat;
+	double	   *writeLat;
+	long		nreads = 0;
+	long		nwrites = 0;
+	long		blocks[2] = {0, 0};
+	long		i;
+	int			c;
+
+	memset(&replay, 0, sizeof(replay));
+	replay.dir = ".";
+	replay.queueDepth = 1;
+	replay.nbuffers = 16384;
+	replay.latency = 100;
+
+	while ((c = getopt(argc, argv, "b:q:d:B:l:a:h")) != -1)
+	{
+		switch (c)
+		{
+			case 'b':
+				backendName = optarg;
+				break;
+			case 'q':
+				replay.queueDepth = atoi(optarg);
+				break;
+			case 'd':
+				replay.dir = optarg;
+				break;
+			case 'B':
+				replay.nbuffers = atoi(optarg);
+				break;
+			case 'l':
+				replay.latency = atol(optarg);
+				break;
+			case 'a':
+				replay.address = optarg;
+				break;
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+
+	if (optind >= argc)
+	{
+		usage();
+		exit(1);
+	}
+	if (replay.queueDepth < 1 || replay.nbuffers < 1 || replay.latency < 0)
+		replayError("queue depth and buffers must be positive");
+
+	for (i = 0; backends[i].name != NULL; i++)
+	{
+		if (strcmp(backends[i].name, backendName) == 0)
+			replay.backend = &backends[i];
+	}
+	if (replay.backend == NULL)
+		replayError("unknown backend \"%s\"", backendName);
+
+	for (; optind < argc; optind++)
+		loadCapture(&replay, argv[optind]);
+	if (replay.nrecs == 0)
+		replayError("the captures have no records");
+
+	readLat = malloc(sizeof(double) * replay.nrecs);
+	writeLat = malloc(sizeof(double) * replay.nrecs);
+	if (readLat == NULL || writeLat == NULL)
+		replayError("out of memory");
+
+	replay.backend->open(&replay);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < replay.nrecs;)
+	{
+		const OblivCaptureRecord *recs = &replay.recs[i];
+		int			n = 1;
+		double		lat;
+
+		while (i + n < replay.nrecs && (recs[n].flags & OBLIV_CAPTURE_CONT))
+			n++;
+
+		clock_gettime(CLOCK_MONOTONIC, &reqStart);
+		replay.backend->request(&replay, recs, n);
+		clock_gettime(CLOCK_MONOTONIC, &reqEnd);
+
+		lat = elapsedUsec(&reqStart, &reqEnd);
+		if (recs[0].op == OBLIV_CAPTURE_WRITE)
+			writeLat[nwrites++] = lat;
+		else
+			readLat[nreads++] = lat;
+		blocks[recs[0].op] += n;
+
+		i += n;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	replay.backend->close(&replay);
+
+	printf("backend %s, queue depth %d, block size %u\n",
+		   replay.backend->name, replay.queueDepth, replay.blockSize);
+	printf("blocks read %ld, written %ld in %.3f s, %.1f MB/s\n",
+		   blocks[OBLIV_CAPTURE_READ], blocks[OBLIV_CAPTURE_WRITE],
+		   elapsedUsec(&start, &end) / 1000000.0,
+		   (blocks[0] + blocks[1]) * (double) replay.blockSize / elapsedUsec(&start, &end));
+	printLatencies("read", readLat, nreads);
+	printLatencies("write", writeLat, nwrites);
+	if (replay.backend->request == bufmgrRequest)
+		printf("buffer hits %ld, misses %ld, evictions %ld\n",
+			   replay.hits, replay.misses, replay.evictions);
+
+	free(readLat);
+	free(writeLat);
+	free(replay.recs);
+
+	return 0;
+}